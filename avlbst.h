@@ -7,6 +7,8 @@
 #include <cstdint>
 #include <algorithm>
 #include "bst.h"
+#include "thread-pool.h"
+#include "parallel-sort.h"
 
 struct KeyError { };
 
@@ -21,22 +23,30 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename... Args>
+    AVLNode(EmplaceTag tag, AVLNode<Key, Value>* parent, Args&&... args);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
+    // Getter/setter for the number of nodes in this subtree. Only kept up to
+    // date by trees that enable order statistics.
+    uint32_t getSubtreeSize() const;
+    void setSubtreeSize(uint32_t size);
+
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide the Node versions
+    // rather than override them; see the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
+    uint32_t subtreeSize_;  // sits in what would otherwise be padding
 };
 
 /*
@@ -50,7 +60,18 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent), balance_(0), subtreeSize_(1)
+{
+
+}
+
+/**
+* An in-place constructor, forwarding the item arguments to the base class.
+*/
+template<class Key, class Value>
+template<typename... Args>
+AVLNode<Key, Value>::AVLNode(EmplaceTag tag, AVLNode<Key, Value> *parent, Args&&... args) :
+    Node<Key, Value>(tag, parent, std::forward<Args>(args)...), balance_(0), subtreeSize_(1)
 {
 
 }
@@ -92,7 +113,25 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A getter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+uint32_t AVLNode<Key, Value>::getSubtreeSize() const
+{
+    return subtreeSize_;
+}
+
+/**
+* A setter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::setSubtreeSize(uint32_t size)
+{
+    subtreeSize_ = size;
+}
+
+/**
+* A redefined function for getting the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
 template<class Key, class Value>
@@ -102,7 +141,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +150,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -127,98 +166,214 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* A self-balancing AVL tree. With OrderStats set, every node also tracks the
+* size of its subtree, which enables select() and rank() in O(log n) at the
+* price of touching every ancestor on insert and remove.
+*/
+template <class Key, class Value, class Alloc = HeapNodeAllocator, bool OrderStats = false>
+class AVLTree : public BinarySearchTree<Key, Value, Alloc>
 {
 public:
+    typedef typename BinarySearchTree<Key, Value, Alloc>::iterator iterator;
+
+    virtual ~AVLTree();
+
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    virtual void insert (std::pair<const Key, Value> &&new_item);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
     virtual void remove(const Key& key);  // TODO
+    bool isValidAVL() const;
+
+    template<typename ForwardIt>
+    void buildFromSorted(ForwardIt first, ForwardIt last);
+    template<typename RandomIt>
+    void buildFromUnsorted(RandomIt first, RandomIt last, ThreadPool* pool = NULL);
+    size_t import(TreeStreamReader<Key, Value>& in,
+                  size_t batchItems = TreeStreamReader<Key, Value>::DEFAULT_BATCH_ITEMS);
+
+    // Key-range surgery without copying: both relink whole subtrees.
+    void join(AVLTree& left, const std::pair<const Key, Value>& item, AVLTree& right);
+    void split(const Key& key, AVLTree& right);
+
+    // Bulk set operations by split and join; other is left empty.
+    void unionWith(AVLTree& other, ThreadPool* pool = NULL);
+    void intersect(AVLTree& other, ThreadPool* pool = NULL);
+    void difference(AVLTree& other, ThreadPool* pool = NULL);
+
+    // Order statistics; only available with OrderStats set.
+    iterator select(size_t k) const;
+    size_t rank(const Key& key) const;
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
     // Add helper functions here
     void rotateLeft(AVLNode<Key,Value>* node);
     void rotateRight(AVLNode<Key,Value>* node);
+    static uint32_t subtreeSize(const AVLNode<Key,Value>* node);
+    static void updateSubtreeSize(AVLNode<Key,Value>* node);
+    static void adjustAncestorSizes(AVLNode<Key,Value>* node, int diff);
+    static int perfectHeight(size_t count);
+    static int subtreeHeight(const AVLNode<Key,Value>* node);
+    AVLNode<Key,Value>* joinSubtrees(AVLNode<Key,Value>* left, int leftHeight, AVLNode<Key,Value>* mid,
+                                     AVLNode<Key,Value>* right, int rightHeight, int& height);
+    static void detach(AVLNode<Key,Value>* node, int height, AVLNode<Key,Value>*& left, int& leftHeight,
+                       AVLNode<Key,Value>*& right, int& rightHeight);
+    void splitHelp(AVLNode<Key,Value>* node, int height, const Key& key,
+                   AVLNode<Key,Value>*& left, int& leftHeight, AVLNode<Key,Value>*& right, int& rightHeight,
+                   AVLNode<Key,Value>** match = NULL);
+    void splitLast(AVLNode<Key,Value>* node, int height, AVLNode<Key,Value>*& rest, int& restHeight,
+                   AVLNode<Key,Value>*& last);
+    AVLNode<Key,Value>* joinTwo(AVLNode<Key,Value>* left, int leftHeight,
+                                AVLNode<Key,Value>* right, int rightHeight, int& height);
+    template<typename LeftTask, typename RightTask>
+    void forkJoin(ThreadPool* pool, int height, LeftTask left, RightTask right);
+    AVLNode<Key,Value>* unionHelp(AVLNode<Key,Value>* a, int aHeight, AVLNode<Key,Value>* b, int bHeight,
+                                  ThreadPool* pool, int& height, size_t& matches);
+    AVLNode<Key,Value>* intersectHelp(AVLNode<Key,Value>* a, int aHeight, AVLNode<Key,Value>* b, int bHeight,
+                                      ThreadPool* pool, int& height, size_t& matches);
+    AVLNode<Key,Value>* differenceHelp(AVLNode<Key,Value>* a, int aHeight, AVLNode<Key,Value>* b, int bHeight,
+                                       ThreadPool* pool, int& height, size_t& matches);
+
+    // Subtrees at least this tall, or built from this many items, are
+    // worth handing to another thread.
+    static const int PARALLEL_HEIGHT = 12;
+    static const size_t PARALLEL_BUILD = 1 << 14;
+    static size_t countLeft(AVLNode<Key,Value>* left, AVLNode<Key,Value>* right, size_t total);
+    template<typename ForwardIt>
+    AVLNode<Key,Value>* buildSubtree(ForwardIt& it, ForwardIt last, size_t count);
+    template<typename RandomIt>
+    AVLNode<Key,Value>* buildSubtreeAt(RandomIt first, const std::pair<Key, size_t>* order, size_t count,
+                                       ThreadPool* pool);
+    virtual AVLNode<Key,Value>* loadSubtree(const Key* keys, const Value* values, size_t count);
+    AVLNode<Key,Value>* loadNodes(const Key* keys, const Value* values, size_t count, std::true_type);
+    AVLNode<Key,Value>* loadNodes(const Key* keys, const Value* values, size_t count, std::false_type);
+    static void attachBuilt(AVLNode<Key,Value>* node, AVLNode<Key,Value>* left, size_t leftCount,
+                            AVLNode<Key,Value>* right, size_t rightCount);
     AVLNode<Key,Value>* predecessor(AVLNode<Key, Value>* current);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void afterInsert(Node<Key, Value>* node);
+    virtual bool buildsPlainNodes() const;
+    virtual std::pair<iterator, bool> assignOrInsert(const Key& key, const Value& value);
+    virtual std::pair<iterator, bool> insertMoved(std::pair<const Key, Value>&& new_item);
+    virtual bool checkStoredBalance(const Node<Key, Value>* node, int leftHeight, int rightHeight) const;
     void insertFix(AVLNode<Key,Value>* parent, AVLNode<Key,Value>* node);
     void removeFix(AVLNode<Key,Value>* parent, int diff);
     AVLNode<Key, Value>* internalFind(const Key& key) const;
 };
 
+/*
+ * Clears here rather than in the base destructor, which could only
+ * destroy the nodes as plain Nodes.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLTree<Key, Value, Alloc, OrderStats>::~AVLTree()
+{
+    this->clear();
+}
+
+/*
+ * Destroys a node as the AVLNode it really is.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::destroyNode(Node<Key, Value>* node)
+{
+    static_cast<AVLNode<Key, Value>*>(node)->~AVLNode();
+    this->alloc_.deallocate(node);
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
  */
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::insert (const std::pair<const Key, Value> &new_item)
 {
     // TODO
-    AVLNode<Key, Value>* node = new AVLNode<Key,Value>(new_item.first,new_item.second,NULL);
+    assignOrInsert(new_item.first, new_item.second);
+}
 
-    //tree is empty, make the new node the root
-    if(this->root_ == NULL){
-        this->root_ = node;
-        node->setBalance(0);
-        return;
-    }
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::insert (std::pair<const Key, Value> &&new_item)
+{
+    insertMoved(std::move(new_item));
+}
 
-    //find insertion point in the tree
-    AVLNode<Key, Value>* parent = NULL;
-    AVLNode<Key,Value>* curr = static_cast<AVLNode<Key,Value>*>(this->root_);
-    while (curr != NULL){
-        parent = curr;
-        if(node->getKey() < curr->getKey()){
-            curr = curr->getLeft();
-        }
-        else if (node->getKey() > curr->getKey()){
-            curr = curr->getRight();
-        }
-        else {
-            //if key already exists, overwrite the value and return
-            curr->setValue(new_item.second);
-            delete node;
-            return;
-        }
-    }
+template<class Key, class Value, class Alloc, bool OrderStats>
+std::pair<typename AVLTree<Key, Value, Alloc, OrderStats>::iterator, bool>
+AVLTree<Key, Value, Alloc, OrderStats>::insertMoved(std::pair<const Key, Value>&& new_item)
+{
+    return this->template moveInsertNode<AVLNode<Key, Value> >(std::move(new_item));
+}
 
-    //attach new node to parent
-    if (node->getKey() < parent->getKey()){
-        parent->setLeft(node); //insert at left
-    }
-    else if (node->getKey() > parent->getKey()){
-        parent->setRight(node); //insert at right
-    }
-    node->setParent(parent); //set parent
-    node->setBalance(0);
+/*
+ * Makes BinarySearchTree::emplace, when called through a base reference,
+ * move its item into an AVLNode via insertMoved.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+bool AVLTree<Key, Value, Alloc, OrderStats>::buildsPlainNodes() const
+{
+    return false;
+}
 
-    
-    if(parent->getBalance() == -1){
-        parent->setBalance(0);
+/*
+ * Searches before allocating, so overwriting an existing key never
+ * touches the allocator. Returns true iff a node was inserted.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+std::pair<typename AVLTree<Key, Value, Alloc, OrderStats>::iterator, bool>
+AVLTree<Key, Value, Alloc, OrderStats>::assignOrInsert(const Key& key, const Value& value)
+{
+    return this->template assignOrInsertNode<AVLNode<Key, Value> >(
+        key, value, typename BinarySearchTree<Key, Value, Alloc>::ValueCopyable());
+}
+
+/*
+ * Builds the item in place inside a new AVLNode, see BinarySearchTree::emplace.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Alloc, OrderStats>::iterator, bool>
+AVLTree<Key, Value, Alloc, OrderStats>::emplace(Args&&... args)
+{
+    return this->template emplaceNode<AVLNode<Key, Value> >(std::forward<Args>(args)...);
+}
+
+/*
+ * Updates the balance of a freshly linked node's parent and walks up
+ * with insertFix if the parent's height grew.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::afterInsert(Node<Key, Value>* inserted)
+{
+    AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(inserted);
+    AVLNode<Key, Value>* parent = node->getParent();
+    if (parent == NULL){
         return;
     }
-    
-    if (parent->getBalance() == 1){
+    // sizes must be right before insertFix rotates anything
+    adjustAncestorSizes(parent, 1);
+
+    if(parent->getBalance() != 0){
         parent->setBalance(0);
-        return;
     }
-
-    if (parent->getBalance() == 0){
+    else {
         //update balance of parent
         if (node == parent->getLeft()){
             parent->updateBalance(-1);
         }
-        else if (node == parent->getRight()){
+        else {
             parent->updateBalance(1);
         }
         insertFix(parent,node);
-        return;
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* parent, AVLNode<Key,Value>* node){
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::insertFix(AVLNode<Key,Value>* parent, AVLNode<Key,Value>* node){
     if (parent == NULL){
         return;
     }
@@ -308,13 +463,13 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* parent, AVLNode<Key,Valu
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>:: remove(const Key& key)
 {
     
     AVLNode<Key, Value>* node = internalFind(key);
     AVLNode<Key,Value>* parent = NULL;
-    int diff;
+    int diff = 0;
     if (node == NULL){
         return;
     }
@@ -459,14 +614,15 @@ void AVLTree<Key, Value>:: remove(const Key& key)
     // }
 
     
-    delete node;
+    this->destroyNode(node);
+    --this->size_;
     //node = NULL;
+    adjustAncestorSizes(parent, -1);
     removeFix(parent,diff);
-    this->print();
 }
 
-template<typename Key, typename Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Alloc, OrderStats>::internalFind(const Key& key) const
 {
     // TODO
     AVLNode<Key,Value>* curr = static_cast<AVLNode<Key,Value>*>(this->root_);
@@ -485,8 +641,8 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::internalFind(const Key& key) const
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>:: removeFix(AVLNode<Key,Value>* parent, int diff)
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>:: removeFix(AVLNode<Key,Value>* parent, int diff)
 {
     if (parent == NULL){
         return;
@@ -494,7 +650,7 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key,Value>* parent, int diff)
 
     AVLNode<Key,Value>* p = parent->getParent();
 
-    int ndiff;
+    int ndiff = 0;
     if (p != NULL && parent == p->getLeft()){
         ndiff = 1;
     }
@@ -603,17 +759,930 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key,Value>* parent, int diff)
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/*
+ * True iff every node is within one level of balance and every stored
+ * balance matches the real subtree heights. Runs in O(n); use
+ * balanceReport() to find out which node is wrong.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+bool AVLTree<Key, Value, Alloc, OrderStats>::isValidAVL() const
+{
+    typename BinarySearchTree<Key, Value, Alloc>::BalanceReport report = this->balanceReport();
+    return report.worstImbalance <= 1 && report.badBalanceNode == NULL;
+}
+
+template<class Key, class Value, class Alloc, bool OrderStats>
+bool AVLTree<Key, Value, Alloc, OrderStats>::checkStoredBalance(const Node<Key, Value>* node, int leftHeight, int rightHeight) const
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    const AVLNode<Key, Value>* avlNode = static_cast<const AVLNode<Key, Value>*>(node);
+    return avlNode->getBalance() == rightHeight - leftHeight;
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last), which
+ * must be sorted by key. Runs of equal keys keep their last item, matching
+ * repeated insert. The tree is built bottom-up in one pass after counting,
+ * already perfectly balanced, so no searches or rotations happen: O(n).
+ * The input is checked before anything is freed, so if it is not sorted
+ * this throws std::invalid_argument and leaves the tree unchanged.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Alloc, OrderStats>::buildFromSorted(ForwardIt first, ForwardIt last)
+{
+    size_t count = 0;
+    for (ForwardIt it = first; it != last; ){
+        ForwardIt next = it;
+        ++next;
+        if (next != last && next->first < it->first){
+            throw std::invalid_argument("buildFromSorted: input is not sorted");
+        }
+        if (next == last || it->first < next->first){
+            ++count;
+        }
+        it = next;
+    }
+
+    this->clear();
+    this->root_ = buildSubtree(first, last, count);
+    this->size_ = count;
+}
+
+/*
+ * Builds a subtree from the next count distinct keys: the left half first,
+ * then the middle node, then the right half, consuming the input in order.
+ * The right half gets the extra node when count is even, so every balance
+ * is 0 or +1 and follows from the two subtree sizes.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+template<typename ForwardIt>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::buildSubtree(ForwardIt& it, ForwardIt last, size_t count)
+{
+    if (count == 0){
+        return NULL;
+    }
+    size_t leftCount = (count - 1) / 2;
+    size_t rightCount = count - 1 - leftCount;
+
+    AVLNode<Key,Value>* left = buildSubtree(it, last, leftCount);
+
+    // skip to the last item of a run of equal keys
+    ForwardIt item = it;
+    for (++it; it != last && !(item->first < it->first); ++it){
+        item = it;
+    }
+
+    AVLNode<Key,Value>* node = NULL;
+    AVLNode<Key,Value>* right = NULL;
+    try {
+        node = this->template createNode<AVLNode<Key, Value> >(EmplaceTag(), static_cast<AVLNode<Key, Value>*>(NULL), *item);
+        right = buildSubtree(it, last, rightCount);
+    }
+    catch (...) {
+        this->clearHelp(left);
+        if (node != NULL){
+            this->destroyNode(node);
+        }
+        throw;
+    }
+
+    attachBuilt(node, left, leftCount, right, rightCount);
+    return node;
+}
+
+/*
+ * Links two perfectly balanced subtrees of the given sizes under node.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::attachBuilt(AVLNode<Key,Value>* node, AVLNode<Key,Value>* left, size_t leftCount,
+                                                         AVLNode<Key,Value>* right, size_t rightCount)
+{
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != NULL){
+        left->setParent(node);
+    }
+    if (right != NULL){
+        right->setParent(node);
+    }
+    node->setBalance(perfectHeight(rightCount) - perfectHeight(leftCount));
+    node->setSubtreeSize(leftCount + 1 + rightCount);
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last), in
+ * any order. Where a key repeats, the item nearest last wins, matching
+ * repeated insert. The keys are sorted together with their positions (on
+ * pool if given, see parallelSort), then the distinct keys are built into
+ * a perfectly balanced tree whose two halves are built in parallel, so
+ * the whole build is O(n log n) work with no rebalancing. The input is
+ * only read. Key must be default constructible.
+ *
+ * The new tree is built before the old one is freed, so if copying an
+ * item or allocating throws, the tree is left unchanged.
+ *
+ * The build allocates nodes from several threads, so with a pool
+ * allocator, which is not thread-safe, only the sort uses the pool.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+template<typename RandomIt>
+void AVLTree<Key, Value, Alloc, OrderStats>::buildFromUnsorted(RandomIt first, RandomIt last, ThreadPool* pool)
+{
+    size_t n = last - first;
+    std::vector<std::pair<Key, size_t> > order(n);
+    for (size_t i = 0; i < n; ++i){
+        order[i].first = first[i].first;
+        order[i].second = i;
+    }
+    parallelSort(order, std::less<std::pair<Key, size_t> >(), pool);
+
+    // keep the last position of each run of equal keys
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i){
+        if (i + 1 == n || order[i].first < order[i + 1].first){
+            order[count++] = order[i];
+        }
+    }
+
+    AVLNode<Key,Value>* root = buildSubtreeAt(first, order.data(), count, Alloc::bulkRelease ? NULL : pool);
+
+    // not clear(): a bulk-release allocator would free the new nodes too
+    Node<Key, Value>* old = this->root_;
+    this->root_ = root;
+    this->size_ = count;
+    this->clearHelp(old);
+}
+
+/*
+ * Builds count nodes from first[order[i].second] for i in [0, count),
+ * middle item at the root, the halves in parallel when large enough.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+template<typename RandomIt>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::buildSubtreeAt(RandomIt first,
+    const std::pair<Key, size_t>* order, size_t count, ThreadPool* pool)
+{
+    if (count == 0){
+        return NULL;
+    }
+    size_t leftCount = (count - 1) / 2;
+    size_t rightCount = count - 1 - leftCount;
+
+    AVLNode<Key,Value>* left = NULL;
+    AVLNode<Key,Value>* right = NULL;
+    AVLNode<Key,Value>* node = NULL;
+    try {
+        if (pool != NULL && count >= PARALLEL_BUILD){
+            pool->parallelInvoke(
+                [&]() { left = buildSubtreeAt(first, order, leftCount, pool); },
+                [&]() { right = buildSubtreeAt(first, order + leftCount + 1, rightCount, pool); });
+        }
+        else {
+            left = buildSubtreeAt(first, order, leftCount, pool);
+            right = buildSubtreeAt(first, order + leftCount + 1, rightCount, pool);
+        }
+        node = this->template createNode<AVLNode<Key, Value> >(
+            EmplaceTag(), static_cast<AVLNode<Key, Value>*>(NULL), first[order[leftCount].second]);
+    }
+    catch (...) {
+        this->clearHelp(left);
+        this->clearHelp(right);
+        throw;
+    }
+    attachBuilt(node, left, leftCount, right, rightCount);
+    return node;
+}
+
+/*
+ * Like BinarySearchTree::import, but each batch is sorted by key before
+ * it is inserted. Consecutive inserts then follow neighbouring paths that
+ * are still cached, which for batches much smaller than the tree beats
+ * both stream order and building the batch and merging it with
+ * unionWith. The sort is stable, so a repeated key still ends up with its
+ * last value.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+size_t AVLTree<Key, Value, Alloc, OrderStats>::import(TreeStreamReader<Key, Value>& in, size_t batchItems)
+{
+    std::vector<std::pair<Key, Value> > batch;
+    size_t total = 0;
+    while (in.read(batch, batchItems) != 0){
+        std::stable_sort(batch.begin(), batch.end(),
+            [](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) { return a.first < b.first; });
+        for (size_t i = 0; i < batch.size(); ++i){
+            assignOrInsert(batch[i].first, batch[i].second);
+        }
+        total += batch.size();
+    }
+    return total;
+}
+
+/*
+ * BinarySearchTree::load builds its nodes through here, so a loaded
+ * AVLTree gets AVL nodes with their balances and subtree sizes already
+ * set, however load was called.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::loadSubtree(const Key* keys, const Value* values, size_t count)
+{
+    return loadNodes(keys, values, count, typename BinarySearchTree<Key, Value, Alloc>::ItemsLoadable());
+}
+
+/*
+ * Like buildSubtree, but from the parallel key and value arrays of a
+ * mapped tree file, whose keys are already distinct.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::loadNodes(const Key* keys, const Value* values, size_t count,
+                                                                       std::true_type)
+{
+    if (count == 0){
+        return NULL;
+    }
+    size_t leftCount = (count - 1) / 2;
+    size_t rightCount = count - 1 - leftCount;
+
+    AVLNode<Key,Value>* left = loadNodes(keys, values, leftCount, std::true_type());
+    AVLNode<Key,Value>* node = NULL;
+    AVLNode<Key,Value>* right = NULL;
+    try {
+        node = this->template createNode<AVLNode<Key, Value> >(
+            EmplaceTag(), static_cast<AVLNode<Key, Value>*>(NULL), keys[leftCount], values[leftCount]);
+        right = loadNodes(keys + leftCount + 1, values + leftCount + 1, rightCount, std::true_type());
+    }
+    catch (...) {
+        this->clearHelp(left);
+        if (node != NULL){
+            this->destroyNode(node);
+        }
+        throw;
+    }
+    attachBuilt(node, left, leftCount, right, rightCount);
+    return node;
+}
+
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::loadNodes(const Key* keys, const Value* values, size_t count,
+                                                                       std::false_type)
+{
+    throw std::logic_error("load needs trivially copyable Key and Value");
+}
+
+/*
+ * Height (in nodes) of a perfectly balanced tree holding count nodes.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+int AVLTree<Key, Value, Alloc, OrderStats>::perfectHeight(size_t count)
+{
+    int height = 0;
+    while (count != 0){
+        ++height;
+        count >>= 1;
+    }
+    return height;
+}
+
+/*
+ * Replaces the contents of this tree with every item of left, then item,
+ * then every item of right, and leaves left and right empty. The nodes of
+ * left and right are relinked, not copied, in O(log n) time. this may be
+ * left or right itself, e.g. a.join(a, item, b) appends item and b to a.
+ * Throws std::invalid_argument, changing nothing, unless every key in
+ * left is less than item's key and every key in right is greater.
+ *
+ * Nodes move between trees, so the allocator must be one whose nodes any
+ * tree can free, i.e. not a bulkRelease pool.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::join(AVLTree& left, const std::pair<const Key, Value>& item, AVLTree& right)
+{
+    static_assert(!Alloc::bulkRelease, "join() moves nodes between trees, which a pool allocator cannot free");
+    AVLNode<Key,Value>* leftRoot = static_cast<AVLNode<Key,Value>*>(left.root_);
+    AVLNode<Key,Value>* rightRoot = static_cast<AVLNode<Key,Value>*>(right.root_);
+    const AVLNode<Key,Value>* largest = leftRoot;
+    while (largest != NULL && largest->getRight() != NULL){
+        largest = largest->getRight();
+    }
+    if ((largest != NULL && !(largest->getKey() < item.first)) ||
+        (rightRoot != NULL && !(item.first < right.getSmallestNode()->getKey()))){
+        throw std::invalid_argument("join: keys are not in order");
+    }
+
+    AVLNode<Key,Value>* mid = this->template createNode<AVLNode<Key, Value> >(
+        EmplaceTag(), static_cast<AVLNode<Key, Value>*>(NULL), item);
+    size_t total = left.size_ + right.size_ + 1;
+    int leftHeight = subtreeHeight(leftRoot);
+    int rightHeight = subtreeHeight(rightRoot);
+    left.root_ = NULL;
+    left.size_ = 0;
+    right.root_ = NULL;
+    right.size_ = 0;
+    this->clear();
+
+    int height;
+    this->root_ = joinSubtrees(leftRoot, leftHeight, mid, rightRoot, rightHeight, height);
+    this->size_ = total;
+}
+
+/*
+ * Moves every item whose key is not less than key into right, replacing
+ * its contents, and keeps the smaller keys here. O(log n) relinking; the
+ * two new sizes come from the subtree sizes with OrderStats, and are
+ * otherwise counted by walking both halves in step until the smaller one
+ * ends, O(min(|left|, |right|)). The allocator requirement of join()
+ * applies.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::split(const Key& key, AVLTree& right)
+{
+    static_assert(!Alloc::bulkRelease, "split() moves nodes between trees, which a pool allocator cannot free");
+    if (&right == this){
+        throw std::invalid_argument("split: right must be another tree");
+    }
+    right.clear();
+
+    AVLNode<Key,Value>* root = static_cast<AVLNode<Key,Value>*>(this->root_);
+    size_t total = this->size_;
+    this->root_ = NULL;
+    this->size_ = 0;
+
+    AVLNode<Key,Value>* leftRoot;
+    AVLNode<Key,Value>* rightRoot;
+    int leftHeight, rightHeight;
+    splitHelp(root, subtreeHeight(root), key, leftRoot, leftHeight, rightRoot, rightHeight);
+
+    size_t leftCount = OrderStats ? subtreeSize(leftRoot) : countLeft(leftRoot, rightRoot, total);
+    this->root_ = leftRoot;
+    this->size_ = leftCount;
+    right.root_ = rightRoot;
+    right.size_ = total - leftCount;
+}
+
+/*
+ * Height (in nodes) of a subtree, following the taller child at each
+ * level as told by the balances. O(log n).
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+int AVLTree<Key, Value, Alloc, OrderStats>::subtreeHeight(const AVLNode<Key,Value>* node)
+{
+    int height = 0;
+    for (; node != NULL; ++height){
+        node = node->getBalance() > 0 ? node->getRight() : node->getLeft();
+    }
+    return height;
+}
+
+/*
+ * Joins two detached subtrees of the given heights around mid, all keys
+ * of left < mid < all keys of right, and returns the new root with its
+ * height. If the heights differ by more than one, mid replaces the first
+ * node on the taller tree's inner spine that is at most one taller than
+ * the other tree, which grows that spot by one level exactly like an
+ * insertion, so insertFix restores the balance on the way up. The work
+ * is O(|leftHeight - rightHeight| + 1). Uses root_ as scratch, since the
+ * rotations keep it up to date.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::joinSubtrees(
+    AVLNode<Key,Value>* left, int leftHeight, AVLNode<Key,Value>* mid,
+    AVLNode<Key,Value>* right, int rightHeight, int& height)
+{
+    if (leftHeight <= rightHeight + 1 && rightHeight <= leftHeight + 1){
+        mid->setParent(NULL);
+        mid->setLeft(left);
+        mid->setRight(right);
+        if (left != NULL){
+            left->setParent(mid);
+        }
+        if (right != NULL){
+            right->setParent(mid);
+        }
+        mid->setBalance(rightHeight - leftHeight);
+        updateSubtreeSize(mid);
+        height = 1 + std::max(leftHeight, rightHeight);
+        return mid;
+    }
+
+    bool leftTaller = leftHeight > rightHeight;
+    AVLNode<Key,Value>* root = leftTaller ? left : right;
+    int shorterHeight = leftTaller ? rightHeight : leftHeight;
+    AVLNode<Key,Value>* parent = NULL;
+    AVLNode<Key,Value>* spot = root;
+    int spotHeight = leftTaller ? leftHeight : rightHeight;
+    while (spotHeight > shorterHeight + 1){
+        parent = spot;
+        if (leftTaller){
+            spotHeight -= spot->getBalance() < 0 ? 2 : 1;
+            spot = spot->getRight();
+        }
+        else {
+            spotHeight -= spot->getBalance() > 0 ? 2 : 1;
+            spot = spot->getLeft();
+        }
+    }
+
+    AVLNode<Key,Value>* lower = leftTaller ? spot : left;
+    AVLNode<Key,Value>* upper = leftTaller ? right : spot;
+    mid->setLeft(lower);
+    mid->setRight(upper);
+    if (lower != NULL){
+        lower->setParent(mid);
+    }
+    if (upper != NULL){
+        upper->setParent(mid);
+    }
+    mid->setBalance(leftTaller ? shorterHeight - spotHeight : spotHeight - shorterHeight);
+    updateSubtreeSize(mid);
+    mid->setParent(parent);
+    if (leftTaller){
+        parent->setRight(mid);
+    }
+    else {
+        parent->setLeft(mid);
+    }
+    adjustAncestorSizes(parent, int(subtreeSize(mid)) - int(subtreeSize(spot)));
+
+    // The growth reaches the top, adding a level, exactly when the root
+    // survives and its balance leaves 0.
+    this->root_ = root;
+    int8_t rootBalance = root->getBalance();
+    insertFix(mid, mid->getBalance() < 0 ? mid->getLeft() : mid->getRight());
+    bool grew = this->root_ == root && rootBalance == 0 && root->getBalance() != 0;
+    height = std::max(leftHeight, rightHeight) + grew;
+    return static_cast<AVLNode<Key,Value>*>(this->root_);
+}
+
+/*
+ * Cuts a node of the given height off from its parent and children and
+ * returns the children as detached subtrees with their heights.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::detach(AVLNode<Key,Value>* node, int height,
+    AVLNode<Key,Value>*& left, int& leftHeight, AVLNode<Key,Value>*& right, int& rightHeight)
+{
+    left = node->getLeft();
+    right = node->getRight();
+    leftHeight = height - (node->getBalance() > 0 ? 2 : 1);
+    rightHeight = height - (node->getBalance() < 0 ? 2 : 1);
+    node->setLeft(NULL);
+    node->setRight(NULL);
+    node->setParent(NULL);
+    if (left != NULL){
+        left->setParent(NULL);
+    }
+    if (right != NULL){
+        right->setParent(NULL);
+    }
+}
+
+/*
+ * Splits a detached subtree of the given height into the keys less than
+ * key and the rest, returning both as detached subtrees with heights.
+ * Each node on the search path is joined back with the subtree it does
+ * not descend into; those joins telescope to O(log n) in total. Given
+ * match, a node holding key itself is returned there, detached, instead
+ * of going to the right (*match stays NULL if there is none).
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::splitHelp(
+    AVLNode<Key,Value>* node, int height, const Key& key,
+    AVLNode<Key,Value>*& left, int& leftHeight, AVLNode<Key,Value>*& right, int& rightHeight,
+    AVLNode<Key,Value>** match)
+{
+    if (node == NULL){
+        left = right = NULL;
+        leftHeight = rightHeight = 0;
+        return;
+    }
+    AVLNode<Key,Value>* lower;
+    AVLNode<Key,Value>* upper;
+    int lowerHeight, upperHeight;
+    detach(node, height, lower, lowerHeight, upper, upperHeight);
+
+    if (node->getKey() < key){
+        AVLNode<Key,Value>* rest;
+        int restHeight;
+        splitHelp(upper, upperHeight, key, rest, restHeight, right, rightHeight, match);
+        left = joinSubtrees(lower, lowerHeight, node, rest, restHeight, leftHeight);
+    }
+    else if (key < node->getKey()){
+        AVLNode<Key,Value>* rest;
+        int restHeight;
+        splitHelp(lower, lowerHeight, key, left, leftHeight, rest, restHeight, match);
+        right = joinSubtrees(rest, restHeight, node, upper, upperHeight, rightHeight);
+    }
+    else {
+        left = lower;
+        leftHeight = lowerHeight;
+        if (match != NULL){
+            *match = node;
+            right = upper;
+            rightHeight = upperHeight;
+        }
+        else {
+            right = joinSubtrees(NULL, 0, node, upper, upperHeight, rightHeight);
+        }
+    }
+}
+
+/*
+ * Takes the largest node out of a detached subtree, returning it detached
+ * in last and the remaining nodes in rest.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::splitLast(AVLNode<Key,Value>* node, int height,
+    AVLNode<Key,Value>*& rest, int& restHeight, AVLNode<Key,Value>*& last)
+{
+    AVLNode<Key,Value>* lower;
+    AVLNode<Key,Value>* upper;
+    int lowerHeight, upperHeight;
+    detach(node, height, lower, lowerHeight, upper, upperHeight);
+    if (upper == NULL){
+        rest = lower;
+        restHeight = lowerHeight;
+        last = node;
+        return;
+    }
+    AVLNode<Key,Value>* upperRest;
+    int upperRestHeight;
+    splitLast(upper, upperHeight, upperRest, upperRestHeight, last);
+    rest = joinSubtrees(lower, lowerHeight, node, upperRest, upperRestHeight, restHeight);
+}
+
+/*
+ * Joins two detached subtrees, all keys of left < all keys of right,
+ * using the largest node of left as the middle.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::joinTwo(AVLNode<Key,Value>* left, int leftHeight,
+    AVLNode<Key,Value>* right, int rightHeight, int& height)
+{
+    if (left == NULL){
+        height = rightHeight;
+        return right;
+    }
+    AVLNode<Key,Value>* rest;
+    AVLNode<Key,Value>* last;
+    int restHeight;
+    splitLast(left, leftHeight, rest, restHeight, last);
+    return joinSubtrees(rest, restHeight, last, right, rightHeight, height);
+}
+
+/*
+ * Replaces this tree with the union of both trees, leaving other empty.
+ * For keys in both, other's item is kept, as if every item of other had
+ * been inserted here. Nodes are relinked, not copied: this splits other
+ * around each node of this tree and joins the results, O(m log(n/m + 1))
+ * work for trees of m <= n nodes. With a pool the two halves of each
+ * large enough step run in parallel, giving O(log^2 n) span. The
+ * allocator requirement of join() applies.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::unionWith(AVLTree& other, ThreadPool* pool)
+{
+    static_assert(!Alloc::bulkRelease, "unionWith() moves nodes between trees, which a pool allocator cannot free");
+    if (&other == this){
+        return;
+    }
+    AVLNode<Key,Value>* a = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* b = static_cast<AVLNode<Key,Value>*>(other.root_);
+    size_t total = this->size_ + other.size_;
+    other.root_ = NULL;
+    other.size_ = 0;
+    size_t matches = 0;
+    int height;
+    this->root_ = unionHelp(a, subtreeHeight(a), b, subtreeHeight(b), pool, height, matches);
+    this->size_ = total - matches;
+}
+
+/*
+ * Keeps only the keys also in other, with this tree's items, and leaves
+ * other empty. Complexity and pool use as for unionWith().
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::intersect(AVLTree& other, ThreadPool* pool)
+{
+    static_assert(!Alloc::bulkRelease, "intersect() moves nodes between trees, which a pool allocator cannot free");
+    if (&other == this){
+        return;
+    }
+    AVLNode<Key,Value>* a = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* b = static_cast<AVLNode<Key,Value>*>(other.root_);
+    other.root_ = NULL;
+    other.size_ = 0;
+    size_t matches = 0;
+    int height;
+    this->root_ = intersectHelp(a, subtreeHeight(a), b, subtreeHeight(b), pool, height, matches);
+    this->size_ = matches;
+}
+
+/*
+ * Removes the keys that are in other and leaves other empty. Complexity
+ * and pool use as for unionWith().
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::difference(AVLTree& other, ThreadPool* pool)
+{
+    static_assert(!Alloc::bulkRelease, "difference() moves nodes between trees, which a pool allocator cannot free");
+    if (&other == this){
+        this->clear();
+        return;
+    }
+    AVLNode<Key,Value>* a = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* b = static_cast<AVLNode<Key,Value>*>(other.root_);
+    size_t total = this->size_;
+    other.root_ = NULL;
+    other.size_ = 0;
+    size_t matches = 0;
+    int height;
+    this->root_ = differenceHelp(a, subtreeHeight(a), b, subtreeHeight(b), pool, height, matches);
+    this->size_ = total - matches;
+}
+
+/*
+ * Runs left and right, each given a tree to work through, in parallel if
+ * there is a pool and the subtrees are tall enough to be worth it.
+ * joinSubtrees keeps its scratch root in root_, so a task on another
+ * thread gets a scratch tree of its own.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+template<typename LeftTask, typename RightTask>
+void AVLTree<Key, Value, Alloc, OrderStats>::forkJoin(ThreadPool* pool, int height, LeftTask left, RightTask right)
+{
+    if (pool == NULL || height < PARALLEL_HEIGHT){
+        left(*this);
+        right(*this);
+        return;
+    }
+    pool->parallelInvoke(
+        [&left]() {
+            AVLTree scratch;
+            left(scratch);
+            scratch.root_ = NULL;
+        },
+        [this, &right]() {
+            right(*this);
+        });
+}
+
+/*
+ * Splits b around the root of a and unites the halves recursively. A
+ * node of b with the same key as a's root replaces it.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::unionHelp(
+    AVLNode<Key,Value>* a, int aHeight, AVLNode<Key,Value>* b, int bHeight,
+    ThreadPool* pool, int& height, size_t& matches)
+{
+    if (a == NULL){
+        height = bHeight;
+        return b;
+    }
+    if (b == NULL){
+        height = aHeight;
+        return a;
+    }
+    AVLNode<Key,Value>* aLeft;
+    AVLNode<Key,Value>* aRight;
+    AVLNode<Key,Value>* bLeft;
+    AVLNode<Key,Value>* bRight;
+    AVLNode<Key,Value>* match = NULL;
+    int aLeftHeight, aRightHeight, bLeftHeight, bRightHeight;
+    detach(a, aHeight, aLeft, aLeftHeight, aRight, aRightHeight);
+    splitHelp(b, bHeight, a->getKey(), bLeft, bLeftHeight, bRight, bRightHeight, &match);
+    AVLNode<Key,Value>* mid = a;
+    if (match != NULL){
+        this->destroyNode(a);
+        mid = match;
+        ++matches;
+    }
+
+    AVLNode<Key,Value>* left;
+    AVLNode<Key,Value>* right;
+    int leftHeight, rightHeight;
+    size_t leftMatches = 0, rightMatches = 0;
+    forkJoin(pool, std::min(aHeight, bHeight),
+        [&](AVLTree& tree) {
+            left = tree.unionHelp(aLeft, aLeftHeight, bLeft, bLeftHeight, pool, leftHeight, leftMatches);
+        },
+        [&](AVLTree& tree) {
+            right = tree.unionHelp(aRight, aRightHeight, bRight, bRightHeight, pool, rightHeight, rightMatches);
+        });
+    matches += leftMatches + rightMatches;
+    return joinSubtrees(left, leftHeight, mid, right, rightHeight, height);
+}
+
+/*
+ * Splits b around the root of a, intersects the halves recursively and
+ * keeps a's root only if b had its key. Unmatched nodes are destroyed.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::intersectHelp(
+    AVLNode<Key,Value>* a, int aHeight, AVLNode<Key,Value>* b, int bHeight,
+    ThreadPool* pool, int& height, size_t& matches)
+{
+    if (a == NULL || b == NULL){
+        this->clearHelp(a);
+        this->clearHelp(b);
+        height = 0;
+        return NULL;
+    }
+    AVLNode<Key,Value>* aLeft;
+    AVLNode<Key,Value>* aRight;
+    AVLNode<Key,Value>* bLeft;
+    AVLNode<Key,Value>* bRight;
+    AVLNode<Key,Value>* match = NULL;
+    int aLeftHeight, aRightHeight, bLeftHeight, bRightHeight;
+    detach(a, aHeight, aLeft, aLeftHeight, aRight, aRightHeight);
+    splitHelp(b, bHeight, a->getKey(), bLeft, bLeftHeight, bRight, bRightHeight, &match);
+
+    AVLNode<Key,Value>* left;
+    AVLNode<Key,Value>* right;
+    int leftHeight, rightHeight;
+    size_t leftMatches = 0, rightMatches = 0;
+    forkJoin(pool, std::min(aHeight, bHeight),
+        [&](AVLTree& tree) {
+            left = tree.intersectHelp(aLeft, aLeftHeight, bLeft, bLeftHeight, pool, leftHeight, leftMatches);
+        },
+        [&](AVLTree& tree) {
+            right = tree.intersectHelp(aRight, aRightHeight, bRight, bRightHeight, pool, rightHeight, rightMatches);
+        });
+    matches += leftMatches + rightMatches;
+    if (match == NULL){
+        this->destroyNode(a);
+        return joinTwo(left, leftHeight, right, rightHeight, height);
+    }
+    this->destroyNode(match);
+    ++matches;
+    return joinSubtrees(left, leftHeight, a, right, rightHeight, height);
+}
+
+/*
+ * Splits a around the root of b, drops b's root and any node of a with
+ * its key, and subtracts the halves recursively.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+AVLNode<Key,Value>* AVLTree<Key, Value, Alloc, OrderStats>::differenceHelp(
+    AVLNode<Key,Value>* a, int aHeight, AVLNode<Key,Value>* b, int bHeight,
+    ThreadPool* pool, int& height, size_t& matches)
+{
+    if (a == NULL || b == NULL){
+        this->clearHelp(b);
+        height = aHeight;
+        return a;
+    }
+    AVLNode<Key,Value>* aLeft;
+    AVLNode<Key,Value>* aRight;
+    AVLNode<Key,Value>* bLeft;
+    AVLNode<Key,Value>* bRight;
+    AVLNode<Key,Value>* match = NULL;
+    int aLeftHeight, aRightHeight, bLeftHeight, bRightHeight;
+    detach(b, bHeight, bLeft, bLeftHeight, bRight, bRightHeight);
+    splitHelp(a, aHeight, b->getKey(), aLeft, aLeftHeight, aRight, aRightHeight, &match);
+    this->destroyNode(b);
+    if (match != NULL){
+        this->destroyNode(match);
+        ++matches;
+    }
+
+    AVLNode<Key,Value>* left;
+    AVLNode<Key,Value>* right;
+    int leftHeight, rightHeight;
+    size_t leftMatches = 0, rightMatches = 0;
+    forkJoin(pool, std::min(aHeight, bHeight),
+        [&](AVLTree& tree) {
+            left = tree.differenceHelp(aLeft, aLeftHeight, bLeft, bLeftHeight, pool, leftHeight, leftMatches);
+        },
+        [&](AVLTree& tree) {
+            right = tree.differenceHelp(aRight, aRightHeight, bRight, bRightHeight, pool, rightHeight, rightMatches);
+        });
+    matches += leftMatches + rightMatches;
+    return joinTwo(left, leftHeight, right, rightHeight, height);
+}
+
+/*
+ * Returns how many nodes the left subtree has, given the total of both,
+ * by stepping through the two in order together until one runs out.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+size_t AVLTree<Key, Value, Alloc, OrderStats>::countLeft(AVLNode<Key,Value>* left, AVLNode<Key,Value>* right, size_t total)
+{
+    Node<Key,Value>* a = left;
+    Node<Key,Value>* b = right;
+    while (a != NULL && a->getLeft() != NULL){
+        a = a->getLeft();
+    }
+    while (b != NULL && b->getLeft() != NULL){
+        b = b->getLeft();
+    }
+    iterator end = BinarySearchTree<Key, Value, Alloc>::makeIterator(NULL, NULL);
+    iterator itA = BinarySearchTree<Key, Value, Alloc>::makeIterator(a, NULL);
+    iterator itB = BinarySearchTree<Key, Value, Alloc>::makeIterator(b, NULL);
+    size_t count = 0;
+    for (; itA != end && itB != end; ++itA, ++itB){
+        ++count;
+    }
+    return itA == end ? count : total - count;
+}
+
+/*
+ * Returns an iterator to the k-th smallest item (0-based), or end() if
+ * k >= size(). O(log n).
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+typename AVLTree<Key, Value, Alloc, OrderStats>::iterator
+AVLTree<Key, Value, Alloc, OrderStats>::select(size_t k) const
+{
+    static_assert(OrderStats, "select() needs an AVLTree with OrderStats enabled");
+    AVLNode<Key,Value>* curr = static_cast<AVLNode<Key,Value>*>(this->root_);
+    while (curr != NULL){
+        size_t leftSize = subtreeSize(curr->getLeft());
+        if (k < leftSize){
+            curr = curr->getLeft();
+        }
+        else if (k == leftSize){
+            break;
+        }
+        else {
+            k -= leftSize + 1;
+            curr = curr->getRight();
+        }
+    }
+    return this->makeIterator(curr, this);
+}
+
+/*
+ * Returns the number of keys strictly less than key, whether or not key
+ * itself is in the tree. O(log n).
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+size_t AVLTree<Key, Value, Alloc, OrderStats>::rank(const Key& key) const
+{
+    static_assert(OrderStats, "rank() needs an AVLTree with OrderStats enabled");
+    size_t count = 0;
+    AVLNode<Key,Value>* curr = static_cast<AVLNode<Key,Value>*>(this->root_);
+    while (curr != NULL){
+        if (key < curr->getKey()){
+            curr = curr->getLeft();
+        }
+        else if (key > curr->getKey()){
+            count += subtreeSize(curr->getLeft()) + 1;
+            curr = curr->getRight();
+        }
+        else {
+            count += subtreeSize(curr->getLeft());
+            break;
+        }
+    }
+    return count;
+}
+
+template<class Key, class Value, class Alloc, bool OrderStats>
+uint32_t AVLTree<Key, Value, Alloc, OrderStats>::subtreeSize(const AVLNode<Key,Value>* node)
+{
+    return node == NULL ? 0 : node->getSubtreeSize();
+}
+
+/*
+ * Recomputes a node's subtree size from its children, e.g. after a rotation.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::updateSubtreeSize(AVLNode<Key,Value>* node)
+{
+    if (OrderStats){
+        node->setSubtreeSize(1 + subtreeSize(node->getLeft()) + subtreeSize(node->getRight()));
+    }
+}
+
+/*
+ * Adds diff to the subtree size of node and all of its ancestors.
+ */
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::adjustAncestorSizes(AVLNode<Key,Value>* node, int diff)
+{
+    if (!OrderStats){
+        return;
+    }
+    while (node != NULL){
+        node->setSubtreeSize(node->getSubtreeSize() + diff);
+        node = node->getParent();
+    }
+}
+
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value, Alloc>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    uint32_t tempS = n1->getSubtreeSize();
+    n1->setSubtreeSize(n2->getSubtreeSize());
+    n2->setSubtreeSize(tempS);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* node){
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::rotateLeft(AVLNode<Key,Value>* node){
     
     // AVLNode<Key, Value>* parent = node->getParent();
     // if (parent == NULL){
@@ -673,10 +1742,12 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* node){
     if (rightLeftChild != NULL) {
         rightLeftChild->setParent(node);
     }
+    updateSubtreeSize(node);
+    updateSubtreeSize(rightChild);
 }
 
-template<class Key, class Value>
-void AVLTree<Key,Value>::rotateRight(AVLNode<Key,Value>* node){
+template<class Key, class Value, class Alloc, bool OrderStats>
+void AVLTree<Key, Value, Alloc, OrderStats>::rotateRight(AVLNode<Key,Value>* node){
 
     // AVLNode<Key, Value>* parent = node->getParent();
     // if (parent == NULL){
@@ -735,11 +1806,13 @@ void AVLTree<Key,Value>::rotateRight(AVLNode<Key,Value>* node){
     if (leftRightChild != NULL) {
         leftRightChild->setParent(node);
     }
+    updateSubtreeSize(node);
+    updateSubtreeSize(leftChild);
 }
 
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, bool OrderStats>
 AVLNode<Key, Value>*
-AVLTree<Key, Value>::predecessor(AVLNode<Key, Value>* current)
+AVLTree<Key, Value, Alloc, OrderStats>::predecessor(AVLNode<Key, Value>* current)
 {
 
    if (current == NULL){
@@ -0,0 +1,1022 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "bst.h"
+#include "avlbst.h"
+#include "btree.h"
+#include "rcu-avl.h"
+#include "concurrent-skiplist.h"
+#include "persistent-avl.h"
+#include "compact-avl.h"
+#include "indexed-avl.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+/*
+ * Microbenchmarks for BinarySearchTree, AVLTree and BTree, with std::map
+ * as the reference.
+ *
+ *   bst-bench [n ...]      (default sizes: 1000 10000 100000 1000000)
+ *
+ * For every size, key stream and structure it times insert, find, in-order
+ * iteration, clear and remove, and reports ns/op, last-level cache misses
+ * per op (when perf counters are available) and the memory the tree holds
+ * after the inserts. Key streams:
+ *
+ *   seq   0, 1, 2, ...
+ *   rand  uniform 64-bit keys
+ *   zipf  Zipf(0.99) over n ranks, so hot keys repeat
+ *   desc  n-1, n-2, ..., 0
+ *
+ * seq and desc are the sorted worst case for the unbalanced BST, which is
+ * quadratic there, so those runs are skipped above MAX_DEGENERATE_BST keys.
+ */
+
+typedef uint64_t BenchKey;
+typedef uint64_t BenchValue;
+
+static const size_t MAX_DEGENERATE_BST = 20000;
+
+// Keeps the optimizer from discarding benchmark results.
+static volatile size_t sink;
+
+/*
+ * Counts last-level cache misses of this thread with perf_event_open.
+ * available() is false off Linux or when perf is restricted (containers,
+ * perf_event_paranoid), and the miss column then reads "n/a".
+ */
+class CacheMissCounter
+{
+public:
+    CacheMissCounter() : fd_(-1)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#ifdef __linux__
+        if(fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    bool available() const { return fd_ >= 0; }
+
+    void start()
+    {
+#ifdef __linux__
+        if(fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t stop()
+    {
+        uint64_t count = 0;
+#ifdef __linux__
+        if(fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if(read(fd_, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+private:
+    long fd_;
+};
+
+static CacheMissCounter missCounter;
+
+struct Measurement
+{
+    double nsPerOp;
+    double missesPerOp;   // negative when perf counters are unavailable
+};
+
+// Times one benchmark phase together with its cache misses.
+class Meter
+{
+public:
+    Meter()
+    {
+        missCounter.start();
+        start_ = chrono::steady_clock::now();
+    }
+
+    Measurement stop(size_t ops)
+    {
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start_;
+        uint64_t misses = missCounter.stop();
+        if(ops == 0) {
+            ops = 1;
+        }
+        Measurement m;
+        m.nsPerOp = elapsed.count() / ops;
+        m.missesPerOp = missCounter.available() ? double(misses) / ops : -1;
+        return m;
+    }
+
+private:
+    chrono::steady_clock::time_point start_;
+};
+
+/*
+ * Bytes the process currently holds for data. On glibc this is the live
+ * heap, which stays accurate when a tree reuses memory an earlier tree
+ * freed; elsewhere on Linux it falls back to the resident set size.
+ * Returns 0 where neither can be read.
+ */
+static size_t memoryInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#elif defined(__linux__)
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm == NULL) {
+        return 0;
+    }
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    int fields = fscanf(statm, "%lu %lu", &pages, &resident);
+    fclose(statm);
+    return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Zipf-distributed ranks in [0, n), using the generator from Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases" (as in YCSB).
+ */
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double theta, uint64_t seed) :
+        n_(n), theta_(theta), gen_(seed), uniform_(0.0, 1.0)
+    {
+        zetaN_ = zeta(n, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetaN_);
+    }
+
+    size_t next()
+    {
+        double u = uniform_(gen_);
+        double uz = u * zetaN_;
+        if(uz < 1.0) {
+            return 0;
+        }
+        if(uz < 1.0 + pow(0.5, theta_)) {
+            return 1;
+        }
+        size_t rank = size_t(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    static double zeta(size_t n, double theta)
+    {
+        double sum = 0;
+        for(size_t i = 1; i <= n; i++) {
+            sum += 1.0 / pow(double(i), theta);
+        }
+        return sum;
+    }
+
+    size_t n_;
+    double theta_;
+    double zetaN_;
+    double alpha_;
+    double eta_;
+    mt19937_64 gen_;
+    uniform_real_distribution<double> uniform_;
+};
+
+// Spreads Zipf ranks over the key space so hot keys are not neighbours.
+static BenchKey scramble(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static vector<BenchKey> makeKeys(const string& stream, size_t n, uint64_t seed)
+{
+    vector<BenchKey> keys(n);
+    if(stream == "seq") {
+        for(size_t i = 0; i < n; i++) {
+            keys[i] = i;
+        }
+    }
+    else if(stream == "desc") {
+        for(size_t i = 0; i < n; i++) {
+            keys[i] = n - 1 - i;
+        }
+    }
+    else if(stream == "rand") {
+        mt19937_64 gen(seed);
+        for(size_t i = 0; i < n; i++) {
+            keys[i] = gen();
+        }
+    }
+    else if(stream == "zipf") {
+        ZipfGenerator zipf(n, 0.99, seed);
+        for(size_t i = 0; i < n; i++) {
+            keys[i] = scramble(zipf.next());
+        }
+    }
+    return keys;
+}
+
+// std::map spells remove "erase"; everything else shares one interface.
+template<typename Tree>
+struct TreeOps
+{
+    static void remove(Tree& tree, const BenchKey& key) { tree.remove(key); }
+};
+
+template<>
+struct TreeOps<map<BenchKey, BenchValue> >
+{
+    static void remove(map<BenchKey, BenchValue>& tree, const BenchKey& key) { tree.erase(key); }
+};
+
+static void printRowStart(const string& structure, const string& stream, size_t n)
+{
+    cout << left << setw(10) << structure << setw(7) << stream << right << setw(11) << n << "  ";
+}
+
+static void printHeader()
+{
+    cout << left << setw(10) << "structure" << setw(7) << "stream" << right << setw(11) << "n" << "  "
+         << left << setw(8) << "op" << right << setw(12) << "ns/op"
+         << setw(14) << "LLC miss/op" << setw(10) << "mem MB" << endl;
+}
+
+// memMB < 0 leaves the memory column empty.
+static void printRow(const string& structure, const string& stream, size_t n,
+                     const string& op, const Measurement& m, double memMB = -1)
+{
+    printRowStart(structure, stream, n);
+    cout << left << setw(8) << op << right << fixed << setprecision(1) << setw(12) << m.nsPerOp;
+    if(m.missesPerOp < 0) {
+        cout << setw(14) << "n/a";
+    }
+    else {
+        cout << setw(14) << setprecision(2) << m.missesPerOp;
+    }
+    if(memMB >= 0) {
+        cout << setw(10) << setprecision(1) << memMB;
+    }
+    cout << endl;
+}
+
+/*
+ * Runs insert, find, iterate, clear and remove for one structure over one
+ * key stream. Lookups and removals replay the stream in its own order.
+ */
+template<typename Tree>
+void benchStructure(const string& name, const string& stream, const vector<BenchKey>& keys)
+{
+    size_t n = keys.size();
+    Tree* tree = new Tree;
+
+    size_t memBefore = memoryInUse();
+    Meter insertMeter;
+    for(size_t i = 0; i < n; i++) {
+        tree->insert(make_pair(keys[i], BenchValue(i)));
+    }
+    Measurement insert = insertMeter.stop(n);
+    size_t memAfter = memoryInUse();
+    double memMB = memAfter > memBefore ? (memAfter - memBefore) / (1024.0 * 1024.0) : 0;
+    printRow(name, stream, n, "insert", insert, memMB);
+
+    size_t found = 0;
+    Meter findMeter;
+    for(size_t i = 0; i < n; i++) {
+        found += tree->find(keys[i]) != tree->end();
+    }
+    printRow(name, stream, n, "find", findMeter.stop(n));
+
+    size_t items = 0;
+    BenchValue total = 0;
+    Meter iterateMeter;
+    for(typename Tree::iterator it = tree->begin(); it != tree->end(); ++it) {
+        total += it->second;
+        ++items;
+    }
+    printRow(name, stream, n, "iterate", iterateMeter.stop(items));
+
+    Meter clearMeter;
+    tree->clear();
+    printRow(name, stream, n, "clear", clearMeter.stop(items));
+
+    for(size_t i = 0; i < n; i++) {
+        tree->insert(make_pair(keys[i], BenchValue(i)));
+    }
+    Meter removeMeter;
+    for(size_t i = 0; i < n; i++) {
+        TreeOps<Tree>::remove(*tree, keys[i]);
+    }
+    printRow(name, stream, n, "remove", removeMeter.stop(n));
+
+    delete tree;
+    sink = found + total;
+}
+
+static void benchSize(size_t n)
+{
+    const char* streams[] = { "seq", "rand", "zipf", "desc" };
+    for(size_t s = 0; s < sizeof(streams) / sizeof(streams[0]); s++) {
+        string stream = streams[s];
+        vector<BenchKey> keys = makeKeys(stream, n, 42 + n);
+
+        benchStructure<map<BenchKey, BenchValue> >("std::map", stream, keys);
+        if((stream == "seq" || stream == "desc") && n > MAX_DEGENERATE_BST) {
+            printRowStart("BST", stream, n);
+            cout << "(skipped: sorted input is quadratic)" << endl;
+        }
+        else {
+            benchStructure<BinarySearchTree<BenchKey, BenchValue> >("BST", stream, keys);
+        }
+        benchStructure<AVLTree<BenchKey, BenchValue> >("AVL", stream, keys);
+        benchStructure<AVLTree<BenchKey, BenchValue, PoolNodeAllocator<> > >("AVL+pool", stream, keys);
+        benchStructure<CompactAVLTree<BenchKey, BenchValue> >("CAVL", stream, keys);
+        benchStructure<CompactAVLTree<BenchKey, BenchValue, PoolNodeAllocator<> > >("CAVL+pool", stream, keys);
+        benchStructure<IndexedAVLTree<BenchKey, BenchValue> >("IAVL", stream, keys);
+        benchStructure<BTree<BenchKey, BenchValue> >("BTree", stream, keys);
+    }
+}
+
+static void report(const string& name, double ns)
+{
+    cout << left << setw(40) << name << right << setw(10) << fixed << setprecision(1) << ns << " ns/op" << endl;
+}
+
+// Preloads n keys, then overwrites existing keys `updates` times.
+template<typename Tree>
+void benchUpdateHeavy(const string& name, size_t n, size_t updates)
+{
+    mt19937 gen(42);
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = gen();
+    }
+    Tree tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(make_pair(keys[i], string("initial value")));
+    }
+
+    string payload(64, 'x');
+    Meter insertMeter;
+    for(size_t i = 0; i < updates; i++) {
+        tree.insert(make_pair(keys[gen() % n], payload));
+    }
+    report(name + " insert (overwrite)", insertMeter.stop(updates).nsPerOp);
+
+    size_t inserted = 0;
+    Meter assignMeter;
+    for(size_t i = 0; i < updates; i++) {
+        inserted += tree.insertOrAssign(keys[gen() % n], payload).second;
+    }
+    report(name + " insertOrAssign (overwrite)", assignMeter.stop(updates).nsPerOp);
+    sink = inserted;
+}
+
+// Loads n sorted keys with repeated insert and with buildFromSorted.
+template<typename Tree>
+void benchBulkLoad(const string& name, size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair(int(i), int(i));
+    }
+
+    {
+        Tree tree;
+        Meter meter;
+        for(size_t i = 0; i < n; i++) {
+            tree.insert(items[i]);
+        }
+        report(name + " sorted insert", meter.stop(n).nsPerOp);
+        sink = tree.size();
+    }
+    {
+        Tree tree;
+        Meter meter;
+        tree.buildFromSorted(items.begin(), items.end());
+        report(name + " buildFromSorted", meter.stop(n).nsPerOp);
+        sink = tree.size();
+    }
+}
+
+// Random overwrites of n keys in an AVLTree and in a PersistentAVLTree,
+// keeping a snapshot of the persistent tree every `interval` updates.
+static void benchPersistent(size_t n, size_t updates, size_t interval)
+{
+    mt19937_64 gen(11);
+    vector<BenchKey> keys(updates);
+    for(size_t i = 0; i < updates; i++) {
+        keys[i] = BenchKey(gen() % n);
+    }
+
+    {
+        AVLTree<BenchKey, BenchValue> tree;
+        Meter meter;
+        for(size_t i = 0; i < updates; i++) {
+            tree.insert(make_pair(keys[i], BenchValue(i)));
+        }
+        report("AVL insert", meter.stop(updates).nsPerOp);
+        sink = tree.size();
+    }
+    {
+        PersistentAVLTree<BenchKey, BenchValue> tree;
+        vector<PersistentAVLTree<BenchKey, BenchValue> > snapshots;
+        size_t before = memoryInUse();
+        Meter meter;
+        for(size_t i = 0; i < updates; i++) {
+            tree = tree.insert(make_pair(keys[i], BenchValue(i)));
+            if(i % interval == 0) {
+                snapshots.push_back(tree);
+            }
+        }
+        report("Persistent insert", meter.stop(updates).nsPerOp);
+        cout << "  " << snapshots.size() << " snapshots retained, "
+             << (memoryInUse() - before) / 1048576.0 << " MB in use" << endl;
+
+        Meter snapMeter;
+        for(size_t i = 0; i < updates; i++) {
+            PersistentAVLTree<BenchKey, BenchValue> snapshot(tree);
+            sink = snapshot.size();
+        }
+        report("Persistent snapshot", snapMeter.stop(updates).nsPerOp);
+    }
+}
+
+// Moves the keys from a random pivot upwards out of an AVL tree of n keys
+// and back again: with split and join, and by inserting each key into the
+// other tree and removing it from the first. Without order statistics,
+// split has to count the smaller half to know the new sizes.
+template<typename Tree>
+void benchRangeMigration(const string& name, size_t n, size_t rounds)
+{
+    mt19937_64 gen(13);
+    Tree tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(make_pair(BenchKey(i), BenchValue(i)));
+    }
+
+    Meter splitMeter;
+    for(size_t r = 0; r < rounds; r++) {
+        Tree upper;
+        tree.split(BenchKey(gen() % n), upper);
+        if(!upper.empty()) {
+            pair<BenchKey, BenchValue> pivot = *upper.begin();
+            upper.remove(pivot.first);
+            tree.join(tree, pivot, upper);
+        }
+    }
+    report(name + " split + join", splitMeter.stop(rounds).nsPerOp);
+
+    size_t copyRounds = rounds < 4 ? rounds : 4;
+    Meter copyMeter;
+    for(size_t r = 0; r < copyRounds; r++) {
+        Tree upper;
+        vector<BenchKey> moved;
+        for(typename Tree::iterator it = tree.lowerBound(BenchKey(gen() % n)); it != tree.end(); ++it) {
+            upper.insert(*it);
+            moved.push_back(it->first);
+        }
+        for(size_t i = 0; i < moved.size(); i++) {
+            tree.remove(moved[i]);
+        }
+        for(typename Tree::iterator it = upper.begin(); it != upper.end(); ++it) {
+            tree.insert(*it);
+        }
+    }
+    report(name + " re-insert both ways", copyMeter.stop(copyRounds).nsPerOp);
+    sink = tree.size();
+}
+
+// Merges m random keys into an AVL tree of n keys: by inserting each one,
+// and with unionWith, sequentially and on a pool of `threads` workers.
+// The input trees are rebuilt outside the timed part, since merging
+// consumes them.
+static void benchUnion(size_t n, size_t m, size_t threads)
+{
+    typedef AVLTree<BenchKey, BenchValue> Tree;
+    mt19937_64 gen(17);
+    vector<pair<BenchKey, BenchValue> > base(n);
+    for(size_t i = 0; i < n; i++) {
+        base[i] = make_pair(BenchKey(2 * i), BenchValue(i));
+    }
+    map<BenchKey, BenchValue> extraMap;
+    while(extraMap.size() < m) {
+        extraMap[BenchKey(gen() % (2 * n))] = BenchValue(extraMap.size());
+    }
+    vector<pair<BenchKey, BenchValue> > extra(extraMap.begin(), extraMap.end());
+
+    {
+        Tree tree;
+        tree.buildFromSorted(base.begin(), base.end());
+        Meter meter;
+        for(size_t i = 0; i < extra.size(); i++) {
+            tree.insert(extra[i]);
+        }
+        report("insert each", meter.stop(1).nsPerOp);
+        sink = tree.size();
+    }
+    ThreadPool pool(threads);
+    for(int parallel = 0; parallel < 2; parallel++) {
+        Tree tree, other;
+        tree.buildFromSorted(base.begin(), base.end());
+        other.buildFromSorted(extra.begin(), extra.end());
+        Meter meter;
+        tree.unionWith(other, parallel ? &pool : NULL);
+        report(parallel ? "unionWith, pool" : "unionWith", meter.stop(1).nsPerOp);
+        sink = tree.size();
+    }
+}
+
+// Builds an AVL tree from n records in random order, some keys repeated:
+// by inserting each one, and with buildFromUnsorted, sequentially and on
+// a pool of `threads` workers.
+static void benchUnsortedBuild(size_t n, size_t threads)
+{
+    typedef AVLTree<BenchKey, BenchValue> Tree;
+    mt19937_64 gen(19);
+    vector<pair<BenchKey, BenchValue> > records(n);
+    for(size_t i = 0; i < n; i++) {
+        records[i] = make_pair(BenchKey(gen() % n), BenchValue(i));
+    }
+
+    {
+        Tree tree;
+        Meter meter;
+        for(size_t i = 0; i < n; i++) {
+            tree.insert(records[i]);
+        }
+        report("insert each", meter.stop(n).nsPerOp);
+        sink = tree.size();
+    }
+    ThreadPool pool(threads);
+    for(int parallel = 0; parallel < 2; parallel++) {
+        Tree tree;
+        Meter meter;
+        tree.buildFromUnsorted(records.begin(), records.end(), parallel ? &pool : NULL);
+        report(parallel ? "buildFromUnsorted, pool" : "buildFromUnsorted", meter.stop(n).nsPerOp);
+        sink = tree.size();
+    }
+}
+
+// Restarting with n keys: saving the tree, loading it back, and
+// re-inserting the keys in random order as a restart would without a file.
+static void benchSaveLoad(size_t n)
+{
+    typedef AVLTree<BenchKey, BenchValue> Tree;
+    const string path = "bst-bench.tree";
+    vector<BenchKey> keys = makeKeys("rand", n, 21);
+    Tree tree;
+    {
+        Meter meter;
+        for(size_t i = 0; i < n; i++) {
+            tree.insert(make_pair(keys[i], BenchValue(i)));
+        }
+        report("insert each", meter.stop(n).nsPerOp);
+    }
+    {
+        Meter meter;
+        tree.save(path);
+        report("save", meter.stop(n).nsPerOp);
+    }
+    {
+        Tree loaded;
+        Meter meter;
+        loaded.load(path);
+        report("load", meter.stop(n).nsPerOp);
+        sink = loaded.size();
+    }
+    remove(path.c_str());
+}
+
+// Exporting n keys to a file one operator<< per pair, as text, against
+// tree streams with and without compression, and importing them back.
+static void benchStream(size_t n)
+{
+    typedef AVLTree<BenchKey, BenchValue> Tree;
+    const string path = "bst-bench.stream";
+    vector<BenchKey> keys = makeKeys("rand", n, 22);
+    Tree tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(make_pair(keys[i], BenchValue(i)));
+    }
+    {
+        ofstream out(path.c_str());
+        Meter meter;
+        for(Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            out << it->first << ' ' << it->second << '\n';
+        }
+        out.flush();
+        report("export as text", meter.stop(n).nsPerOp);
+    }
+    for(int compress = 0; compress < 2; compress++) {
+        {
+            ofstream out(path.c_str(), ios::binary);
+            Meter meter;
+            TreeStreamWriter<BenchKey, BenchValue> writer(out, compress);
+            tree.exportTo(writer);
+            writer.finish();
+            report(compress ? "export, compressed" : "export", meter.stop(n).nsPerOp);
+        }
+        {
+            ifstream in(path.c_str(), ios::binary);
+            Tree imported;
+            Meter meter;
+            TreeStreamReader<BenchKey, BenchValue> reader(in);
+            imported.import(reader);
+            report(compress ? "import, compressed" : "import", meter.stop(n).nsPerOp);
+            sink = imported.size();
+        }
+    }
+    remove(path.c_str());
+}
+
+// Full scans of n keys, forward, backward through rbegin()..rend(), and
+// the copy-and-reverse a descending scan needed before.
+static void benchReverseScan(size_t n)
+{
+    typedef AVLTree<BenchKey, BenchValue> Tree;
+    vector<BenchKey> keys = makeKeys("rand", n, 23);
+    Tree tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(make_pair(keys[i], BenchValue(i)));
+    }
+    size_t sum = 0;
+    {
+        Meter meter;
+        for(Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+        report("forward", meter.stop(n).nsPerOp);
+    }
+    {
+        Meter meter;
+        for(Tree::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it) {
+            sum += it->second;
+        }
+        report("reverse", meter.stop(n).nsPerOp);
+    }
+    {
+        Meter meter;
+        vector<pair<BenchKey, BenchValue> > copy(tree.begin(), tree.end());
+        for(size_t i = copy.size(); i-- > 0; ) {
+            sum += copy[i].second;
+        }
+        report("copy and reverse", meter.stop(n).nsPerOp);
+    }
+    sink = sum;
+}
+
+// Random successful lookups in an AVL tree of n keys and in its frozen copy.
+static void benchFrozenLookup(size_t n, size_t lookups)
+{
+    mt19937_64 gen(7);
+    vector<BenchKey> keys(n);
+    AVLTree<BenchKey, BenchValue, PoolNodeAllocator<> > tree;
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = gen();
+        tree.insert(make_pair(keys[i], BenchValue(i)));
+    }
+    FrozenIndex<BenchKey, BenchValue> frozen = tree.freeze();
+    vector<BenchKey> probes(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        probes[i] = keys[gen() % n];
+    }
+
+    size_t found = 0;
+    Meter treeMeter;
+    for(size_t i = 0; i < lookups; i++) {
+        found += tree.find(probes[i]) != tree.end();
+    }
+    report("AVL+pool find", treeMeter.stop(lookups).nsPerOp);
+
+    Meter frozenMeter;
+    for(size_t i = 0; i < lookups; i++) {
+        found += frozen.find(probes[i]) != frozen.end();
+    }
+    report("FrozenIndex find", frozenMeter.stop(lookups).nsPerOp);
+    sink = found;
+}
+
+// Resolves batches of `batch` random keys against a tree of n keys, one
+// find at a time and with findBatch.
+template<typename Tree>
+void benchBatchLookup(const string& name, size_t n, size_t lookups, size_t batch)
+{
+    mt19937_64 gen(11);
+    vector<BenchKey> keys(n);
+    Tree tree;
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = gen();
+        tree.insert(make_pair(keys[i], BenchValue(i)));
+    }
+    size_t batches = lookups / batch;
+    vector<BenchKey> probes(batches * batch);
+    for(size_t i = 0; i < probes.size(); i++) {
+        probes[i] = keys[gen() % n];
+    }
+
+    size_t found = 0;
+    Meter loopMeter;
+    for(size_t i = 0; i < probes.size(); i++) {
+        found += tree.find(probes[i]) != tree.end();
+    }
+    report(name + " find loop", loopMeter.stop(probes.size()).nsPerOp);
+
+    vector<BenchKey> request(batch);
+    vector<typename Tree::iterator> results;
+    Meter batchMeter;
+    for(size_t b = 0; b < batches; b++) {
+        request.assign(probes.begin() + b * batch, probes.begin() + (b + 1) * batch);
+        tree.findBatch(request, results);
+        for(size_t i = 0; i < batch; i++) {
+            found += results[i] != tree.end();
+        }
+    }
+    report(name + " findBatch", batchMeter.stop(probes.size()).nsPerOp);
+    sink = found;
+}
+
+/*
+ * Ways to share an ordered map between threads: an AVLTree behind a
+ * mutex, an RcuAVLTree whose readers never lock, and a
+ * ConcurrentSkipList that also lets writers run in parallel.
+ */
+struct LockedAVL
+{
+    void insert(BenchKey key, BenchValue value)
+    {
+        lock_guard<mutex> lock(guard);
+        tree.insert(make_pair(key, value));
+    }
+    void remove(BenchKey key)
+    {
+        lock_guard<mutex> lock(guard);
+        tree.remove(key);
+    }
+    bool find(BenchKey key, BenchValue& value)
+    {
+        lock_guard<mutex> lock(guard);
+        AVLTree<BenchKey, BenchValue>::iterator it = tree.find(key);
+        if(it == tree.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    mutex guard;
+    AVLTree<BenchKey, BenchValue> tree;
+};
+
+struct SharedRcuAVL
+{
+    void insert(BenchKey key, BenchValue value) { tree.insert(make_pair(key, value)); }
+    void remove(BenchKey key) { tree.remove(key); }
+    bool find(BenchKey key, BenchValue& value) { return tree.find(key, value); }
+
+    RcuAVLTree<BenchKey, BenchValue> tree;
+};
+
+struct SharedSkipList
+{
+    void insert(BenchKey key, BenchValue value) { tree.insert(make_pair(key, value)); }
+    void remove(BenchKey key) { tree.remove(key); }
+    bool find(BenchKey key, BenchValue& value) { return tree.find(key, value); }
+
+    ConcurrentSkipList<BenchKey, BenchValue> tree;
+};
+
+// Runs `readers` lookup threads for `millis` against a tree of n keys
+// that one writer keeps updating; reports lookups per second.
+template<typename Shared>
+void benchReaders(const string& name, size_t n, size_t readers, int millis)
+{
+    Shared shared;
+    for(size_t i = 0; i < n; i++) {
+        shared.insert(BenchKey(i), BenchValue(i));
+    }
+
+    atomic<bool> stop(false);
+    atomic<size_t> lookups(0);
+    vector<thread> threads;
+    for(size_t r = 0; r < readers; r++) {
+        threads.push_back(thread([&shared, &stop, &lookups, n, r]() {
+            mt19937_64 gen(r + 1);
+            size_t count = 0;
+            size_t found = 0;
+            BenchValue value;
+            while(!stop.load(memory_order_relaxed)) {
+                found += shared.find(gen() % n, value);
+                ++count;
+            }
+            lookups.fetch_add(count);
+            sink = found;
+        }));
+    }
+    thread writer([&shared, &stop, n]() {
+        mt19937_64 gen(99);
+        while(!stop.load(memory_order_relaxed)) {
+            BenchKey key = gen() % n;
+            shared.remove(key);
+            shared.insert(key, key);
+        }
+    });
+
+    this_thread::sleep_for(chrono::milliseconds(millis));
+    stop.store(true);
+    writer.join();
+    for(size_t r = 0; r < readers; r++) {
+        threads[r].join();
+    }
+    double perSecond = lookups.load() * 1000.0 / millis;
+    cout << left << setw(12) << name << right << setw(8) << readers << setw(16) << fixed << setprecision(0)
+         << perSecond << " lookups/s" << endl;
+}
+
+// Runs `threads` threads for `millis` against a map of n keys, each doing
+// half lookups and half updates (a remove or an insert) of random keys;
+// reports operations per second.
+template<typename Shared>
+void benchMixed(const string& name, size_t n, size_t threads, int millis)
+{
+    Shared shared;
+    for(size_t i = 0; i < n; i++) {
+        shared.insert(BenchKey(i), BenchValue(i));
+    }
+
+    atomic<bool> stop(false);
+    atomic<size_t> operations(0);
+    vector<thread> workers;
+    for(size_t t = 0; t < threads; t++) {
+        workers.push_back(thread([&shared, &stop, &operations, n, t]() {
+            mt19937_64 gen(t + 1);
+            size_t count = 0;
+            size_t found = 0;
+            BenchValue value;
+            while(!stop.load(memory_order_relaxed)) {
+                uint64_t r = gen();
+                BenchKey key = BenchKey((r >> 2) % n);
+                switch(r & 3) {
+                case 0:
+                    shared.remove(key);
+                    break;
+                case 1:
+                    shared.insert(key, BenchValue(key));
+                    break;
+                default:
+                    found += shared.find(key, value);
+                }
+                ++count;
+            }
+            operations.fetch_add(count);
+            sink = found;
+        }));
+    }
+
+    this_thread::sleep_for(chrono::milliseconds(millis));
+    stop.store(true);
+    for(size_t t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    double perSecond = operations.load() * 1000.0 / millis;
+    cout << left << setw(12) << name << right << setw(8) << threads << setw(16) << fixed << setprecision(0)
+         << perSecond << " ops/s" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<size_t> sizes;
+    for(int i = 1; i < argc; i++) {
+        sizes.push_back(strtoull(argv[i], NULL, 10));
+    }
+    if(sizes.empty()) {
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+        sizes.push_back(1000000);
+    }
+
+    if(!missCounter.available()) {
+        cout << "(perf counters unavailable: cache misses not reported)" << endl;
+    }
+    printHeader();
+    for(size_t i = 0; i < sizes.size(); i++) {
+        benchSize(sizes[i]);
+    }
+
+    size_t n = 100000;
+    size_t updates = 1000000;
+    cout << "\nUpdate-heavy workload: " << n << " keys, " << updates << " overwrites" << endl;
+    benchUpdateHeavy<BinarySearchTree<int, string> >("BST", n, updates);
+    benchUpdateHeavy<AVLTree<int, string> >("AVL", n, updates);
+    benchUpdateHeavy<AVLTree<int, string, PoolNodeAllocator<> > >("AVL+pool", n, updates);
+
+    size_t bulk = n * 10;
+    cout << "\nBulk load: " << bulk << " sorted keys" << endl;
+    benchBulkLoad<AVLTree<int, int> >("AVL", bulk);
+    benchBulkLoad<AVLTree<int, int, PoolNodeAllocator<> > >("AVL+pool", bulk);
+
+    cout << "\nPersistent updates: " << n << " keys, " << updates << " overwrites, snapshot every 10000" << endl;
+    benchPersistent(n, updates, 10000);
+
+    cout << "\nRange migration: " << bulk << " keys, per round trip" << endl;
+    benchRangeMigration<AVLTree<BenchKey, BenchValue> >("AVL", bulk, 1000);
+    benchRangeMigration<AVLTree<BenchKey, BenchValue, HeapNodeAllocator, true> >("AVL+stats", bulk, 1000);
+
+    size_t threads = thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() : 2;
+    cout << "\nUnion, ns per merge: " << bulk << " keys with " << bulk << " and with " << bulk / 100
+         << " more (pool of " << threads << ")" << endl;
+    benchUnion(bulk, bulk, threads);
+    benchUnion(bulk, bulk / 100, threads);
+
+    cout << "\nBuild from unsorted records: " << bulk << " records (pool of " << threads << ")" << endl;
+    benchUnsortedBuild(bulk, threads);
+
+    cout << "\nSave and load: " << bulk << " keys" << endl;
+    benchSaveLoad(bulk);
+
+    cout << "\nStreaming export and import: " << bulk << " keys" << endl;
+    benchStream(bulk);
+
+    cout << "\nFull scan: " << bulk << " keys" << endl;
+    benchReverseScan(bulk);
+
+    cout << "\nFrozen lookup: " << bulk << " keys, " << updates << " finds" << endl;
+    benchFrozenLookup(bulk, updates);
+
+    cout << "\nBatched lookup: " << bulk << " keys, " << updates << " finds in batches of 128" << endl;
+    benchBatchLookup<AVLTree<BenchKey, BenchValue> >("AVL", bulk, updates, 128);
+    benchBatchLookup<AVLTree<BenchKey, BenchValue, PoolNodeAllocator<> > >("AVL+pool", bulk, updates, 128);
+
+    cout << "\nConcurrent readers with one writer: " << n << " keys ("
+         << thread::hardware_concurrency() << " hardware threads)" << endl;
+    cout << left << setw(12) << "structure" << right << setw(8) << "readers" << endl;
+    for(size_t readers = 1; readers <= 32; readers *= 2) {
+        benchReaders<LockedAVL>("mutex+AVL", n, readers, 200);
+        benchReaders<SharedRcuAVL>("RcuAVL", n, readers, 200);
+    }
+
+    cout << "\nConcurrent updates, half lookups and half updates: " << n << " keys" << endl;
+    cout << left << setw(12) << "structure" << right << setw(8) << "threads" << endl;
+    for(size_t threads = 1; threads <= 16; threads *= 2) {
+        benchMixed<LockedAVL>("mutex+AVL", n, threads, 200);
+        benchMixed<SharedSkipList>("SkipList", n, threads, 200);
+    }
+    return 0;
+}
@@ -1,10 +1,616 @@
 #include <iostream>
 #include <map>
+#include <cstdio>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
 #include "bst.h"
 #include "avlbst.h"
+#include "btree.h"
+#include "persistent-avl.h"
+#include "compact-avl.h"
+#include "indexed-avl.h"
 
 using namespace std;
 
+static int failures = 0;
+
+// Reports a failed check; main exits non-zero if there were any.
+static void check(bool ok, const char* what)
+{
+    if(!ok) {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+// True iff tree holds exactly the items of expected, in the same order,
+// and find() agrees with it for every key below keyRange.
+template<typename Tree>
+static bool sameAsMap(const Tree& tree, const std::map<int,int>& expected, int keyRange)
+{
+    if(tree.size() != expected.size()) {
+        return false;
+    }
+    std::map<int,int>::const_iterator want = expected.begin();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++want) {
+        if(want == expected.end() || it->first != want->first || it->second != want->second) {
+            return false;
+        }
+    }
+    if(want != expected.end()) {
+        return false;
+    }
+    for(int key = 0; key < keyRange; key++) {
+        typename Tree::iterator it = tree.find(key);
+        std::map<int,int>::const_iterator found = expected.find(key);
+        if(found == expected.end() ? it != tree.end() : it == tree.end() || it->second != found->second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Grows a BTree with random inserts and removes, shrinks it back to
+// empty, and compares it with a std::map along the way.
+template<size_t NodeBytes>
+static void checkBTree(const char* what)
+{
+    const int keyRange = 20000;
+    BTree<int,int,NodeBytes> tree;
+    std::map<int,int> expected;
+    std::mt19937 gen(NodeBytes);
+    bool ok = true;
+    for(int i = 0; i < 80000 && ok; i++) {
+        int key = gen() % keyRange;
+        // mostly inserts in the first half, mostly removes in the second
+        if((gen() % 4 != 0) == (i < 40000)) {
+            tree.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        else {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        if(i % 10000 == 9999) {
+            ok = sameAsMap(tree, expected, keyRange);
+        }
+    }
+    for(int key = 0; key < keyRange && ok; key++) {
+        tree.remove(key);
+        expected.erase(key);
+        if(key % 5000 == 4999) {
+            ok = sameAsMap(tree, expected, keyRange);
+        }
+    }
+    check(ok && tree.empty() && tree.begin() == tree.end(), what);
+}
+
+// sameAsMap for a balanced tree with reverse iterators and lowerBound():
+// also checks isValidAVL(), the items walked backwards from rbegin(), and
+// lowerBound() for every key below keyRange.
+template<typename Tree>
+static bool sameOrderedAsMap(const Tree& tree, const std::map<int,int>& expected, int keyRange)
+{
+    if(!tree.isValidAVL() || !sameAsMap(tree, expected, keyRange)) {
+        return false;
+    }
+    std::map<int,int>::const_reverse_iterator want = expected.rbegin();
+    for(typename Tree::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it, ++want) {
+        if(want == expected.rend() || it->first != want->first || it->second != want->second) {
+            return false;
+        }
+    }
+    if(want != expected.rend()) {
+        return false;
+    }
+    for(int key = -1; key <= keyRange; key++) {
+        typename Tree::iterator it = tree.lowerBound(key);
+        std::map<int,int>::const_iterator bound = expected.lower_bound(key);
+        if(bound == expected.end() ? it != tree.end() : it == tree.end() || it->first != bound->first) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs random inserts and removes (removePercent of them removes) on a
+// tree holding every other key to begin with, then removes every key in
+// random order, comparing the tree with a std::map along the way.
+template<typename Tree>
+static void checkOrderedTree(int operations, int removePercent, const char* what)
+{
+    const int keyRange = 2000;
+    Tree tree;
+    std::map<int,int> expected;
+    std::mt19937 gen(operations + removePercent);
+    for(int key = 0; key < keyRange; key += 2) {
+        tree.insert(std::make_pair(key, -key));
+        expected[key] = -key;
+    }
+    bool ok = sameOrderedAsMap(tree, expected, keyRange);
+    for(int i = 0; i < operations && ok; i++) {
+        int key = gen() % keyRange;
+        if(int(gen() % 100) < removePercent) {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        else {
+            tree.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        if(i % 500 == 499) {
+            ok = sameOrderedAsMap(tree, expected, keyRange);
+        }
+    }
+    std::vector<int> keys;
+    for(int key = 0; key < keyRange; key++) {
+        keys.push_back(key);
+    }
+    std::shuffle(keys.begin(), keys.end(), gen);
+    for(size_t i = 0; i < keys.size() && ok; i++) {
+        tree.remove(keys[i]);
+        expected.erase(keys[i]);
+        if(i % 250 == 249) {
+            ok = sameOrderedAsMap(tree, expected, keyRange);
+        }
+    }
+    check(ok && tree.empty() && tree.begin() == tree.end() && tree.rbegin() == tree.rend(), what);
+}
+
+// A copy of an IndexedAVLTree is a snapshot: it must keep exactly its
+// items while the original is updated, including by removes that move
+// nodes around the original's array.
+static void checkIndexedSnapshot()
+{
+    const int keyRange = 2000;
+    IndexedAVLTree<int,int> tree;
+    std::map<int,int> expected;
+    std::mt19937 gen(25);
+    for(int i = 0; i < 1500; i++) {
+        int key = gen() % keyRange;
+        tree.insert(std::make_pair(key, i));
+        expected[key] = i;
+    }
+    IndexedAVLTree<int,int> snapshot(tree);
+    std::map<int,int> snapshotExpected = expected;
+    IndexedAVLTree<int,int> assigned;
+    assigned.insert(std::make_pair(keyRange, 0));
+    assigned = tree;
+    for(int i = 0; i < 3000; i++) {
+        int key = gen() % keyRange;
+        if(gen() % 3 != 0) {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        else {
+            tree.insert(std::make_pair(key, -i));
+            expected[key] = -i;
+        }
+    }
+    check(sameOrderedAsMap(tree, expected, keyRange), "IndexedAVLTree updated after copying");
+    check(sameOrderedAsMap(snapshot, snapshotExpected, keyRange)
+          && sameOrderedAsMap(assigned, snapshotExpected, keyRange),
+          "IndexedAVLTree copies keep their items when the original changes");
+}
+
+// A value whose copy constructor throws once copiesLeft runs out, and
+// which counts its live instances so leaks after a failure show up.
+struct FlakyValue
+{
+    static int copiesLeft;  // negative: never throw
+    static int live;
+
+    FlakyValue(int value) : value(value) { ++live; }
+    FlakyValue(const FlakyValue& other) : value(other.value)
+    {
+        if(copiesLeft == 0) {
+            throw std::runtime_error("FlakyValue copy failed");
+        }
+        if(copiesLeft > 0) {
+            --copiesLeft;
+        }
+        ++live;
+    }
+    ~FlakyValue() { --live; }
+    bool operator!=(int rhs) const { return value != rhs; }
+
+    int value;
+};
+
+int FlakyValue::copiesLeft = -1;
+int FlakyValue::live = 0;
+
+// Derives many versions of a PersistentAVLTree from random earlier ones,
+// some of them through updates that throw partway, and checks that every
+// version still holds exactly what it held when it was made.
+static void checkPersistentVersions()
+{
+    const int keyRange = 500;
+    typedef PersistentAVLTree<int, FlakyValue> Tree;
+    std::vector<Tree> versions(1);
+    std::vector<std::map<int,int> > expected(1);
+    std::mt19937 gen(17);
+    bool ok = true;
+    int failedUpdates = 0;
+    for(int i = 0; i < 3000 && ok; i++) {
+        size_t from = gen() % versions.size();
+        int key = gen() % keyRange;
+        bool removing = gen() % 3 == 0;
+        FlakyValue::copiesLeft = i % 4 == 0 ? int(gen() % 16) : -1;
+        try {
+            Tree next = removing ? versions[from].remove(key) : versions[from].insert(std::make_pair(key, FlakyValue(i)));
+            versions.push_back(next);
+            expected.push_back(expected[from]);
+            if(removing) {
+                expected.back().erase(key);
+            }
+            else {
+                expected.back()[key] = i;
+            }
+        }
+        catch(std::runtime_error&) {
+            ++failedUpdates;
+        }
+        FlakyValue::copiesLeft = -1;
+        if(i % 7 == 6) {
+            // drop a version, freeing whatever only it still used
+            size_t dropped = gen() % versions.size();
+            versions[dropped] = versions.back();
+            versions.pop_back();
+            expected[dropped] = expected.back();
+            expected.pop_back();
+        }
+        if(i % 500 == 499) {
+            for(size_t v = 0; v < versions.size() && ok; v++) {
+                ok = versions[v].isValidAVL() && sameAsMap(versions[v], expected[v], keyRange);
+            }
+        }
+    }
+    check(ok && failedUpdates > 0, "PersistentAVLTree versions keep their items");
+
+    versions.clear();
+    check(FlakyValue::live == 0, "PersistentAVLTree frees every node, even after failed updates");
+}
+
+// Freezes trees of n keys 0, 10, 20, ... for n = 0, 1 and 2^k-1, 2^k and
+// 2^k+1, where the Eytzinger layout's last level is full, holds one node
+// or is one short. find() and lowerBound() must agree with the source
+// tree for every key and for misses below, between and above them.
+template<typename Key>
+static void checkFrozenIndex(const char* what)
+{
+    bool ok = true;
+    for(int bits = 0; bits <= 11 && ok; bits++) {
+        int sizes[] = { (1 << bits) - 1, 1 << bits, (1 << bits) + 1 };
+        for(int s = 0; s < 3 && ok; s++) {
+            int n = sizes[s];
+            AVLTree<Key,int> tree;
+            for(int i = 0; i < n; i++) {
+                tree.insert(std::make_pair(Key(10 * i), i));
+            }
+            FrozenIndex<Key,int> frozen = tree.freeze();
+            ok = frozen.size() == size_t(n);
+            typename AVLTree<Key,int>::iterator want = tree.begin();
+            for(typename FrozenIndex<Key,int>::iterator it = frozen.begin(); ok && it != frozen.end(); ++it, ++want) {
+                ok = want != tree.end() && it->first == want->first && it->second == want->second;
+            }
+            ok = ok && want == tree.end();
+            for(Key key = Key(-15); ok && key <= Key(10 * n + 15); key += 5) {
+                typename FrozenIndex<Key,int>::iterator found = frozen.find(key);
+                typename AVLTree<Key,int>::iterator hit = tree.find(key);
+                ok = hit == tree.end() ? found == frozen.end() : found != frozen.end() && found->second == hit->second;
+                typename FrozenIndex<Key,int>::iterator bound = frozen.lowerBound(key);
+                typename AVLTree<Key,int>::iterator expected = tree.lowerBound(key);
+                ok = ok && (expected == tree.end() ? bound == frozen.end()
+                                                   : bound != frozen.end() && bound->first == expected->first);
+            }
+        }
+    }
+    check(ok, what);
+}
+
+// findBatch must return exactly what find() does for each key, in order,
+// whatever order the in-flight lookups finish in. The batches are much
+// larger than the 16 lookups kept in flight, so slots are refilled, and
+// they include misses on both sides and repeated keys.
+static void checkFindBatch()
+{
+    AVLTree<int,int> tree;
+    for(int key = 0; key < 2000; key += 2) {
+        tree.insert(std::make_pair(key, key / 2));
+    }
+    std::mt19937 gen(14);
+    bool ok = true;
+    size_t batchSizes[] = { 0, 1, 17, 100, 1000 };
+    for(size_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); b++) {
+        std::vector<int> wanted;
+        for(size_t i = 0; i < batchSizes[b]; i++) {
+            wanted.push_back(int(gen() % 2100) - 50);
+            if(i % 5 == 4) {
+                wanted.push_back(wanted[gen() % wanted.size()]);
+            }
+        }
+        std::vector<AVLTree<int,int>::iterator> hits(3, tree.begin());
+        tree.findBatch(wanted, hits);
+        ok = ok && hits.size() == wanted.size();
+        for(size_t i = 0; ok && i < wanted.size(); i++) {
+            ok = hits[i] == tree.find(wanted[i]);
+        }
+    }
+    AVLTree<int,int> none;
+    std::vector<int> wanted(20, 7);
+    std::vector<AVLTree<int,int>::iterator> hits;
+    none.findBatch(wanted, hits);
+    for(size_t i = 0; i < hits.size(); i++) {
+        ok = ok && hits[i] == none.end();
+    }
+    check(ok && hits.size() == wanted.size(), "findBatch matches find for every key");
+}
+
+// True iff reading every item of the tree stream in bytes throws
+// std::runtime_error.
+static bool streamIsRejected(const std::string& bytes)
+{
+    std::istringstream in(bytes);
+    try {
+        TreeStreamReader<long long, long long> reader(in);
+        std::vector<std::pair<long long, long long> > batch;
+        while(!reader.done()) {
+            reader.read(batch, 100);
+        }
+    }
+    catch(std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// Round trips through tree streams, raw and compressed: a key range of a
+// tree with negative keys and values, and unsorted 64-bit items whose
+// key deltas wrap around. A truncated or corrupted stream must throw.
+static void checkTreeStream()
+{
+    AVLTree<int,int> source;
+    for(int key = -600; key < 600; key += 3) {
+        source.insert(std::make_pair(key, -7 * key));
+    }
+    std::map<int,int> expected;
+    source.range(-250, 400, [&expected](const std::pair<const int,int>& item) {
+        expected.insert(item);
+    });
+
+    std::mt19937_64 gen(22);
+    std::vector<std::pair<long long, long long> > items;
+    items.push_back(std::make_pair(std::numeric_limits<long long>::max(), std::numeric_limits<long long>::min()));
+    items.push_back(std::make_pair(std::numeric_limits<long long>::min(), std::numeric_limits<long long>::max()));
+    items.push_back(std::make_pair(0LL, -1LL));
+    for(int i = 0; i < 1000; i++) {
+        long long key = static_cast<long long>(gen()) >> (gen() % 64);
+        items.push_back(std::make_pair(key, i % 2 == 0 ? -key : key / 3));
+    }
+
+    for(int compress = 0; compress < 2; compress++) {
+        std::stringstream rangeStream;
+        TreeStreamWriter<int,int> rangeWriter(rangeStream, compress != 0, 64);
+        size_t exported = source.exportRange(-250, 400, rangeWriter);
+        rangeWriter.finish();
+        TreeStreamReader<int,int> rangeReader(rangeStream);
+        AVLTree<int,int> imported;
+        size_t read = imported.import(rangeReader, 50);
+        check(exported == expected.size() && read == expected.size() && imported.isValidAVL()
+              && sameAsMap(imported, expected, 0),
+              compress ? "compressed stream round trip of a key range" : "raw stream round trip of a key range");
+
+        std::stringstream itemStream;
+        TreeStreamWriter<long long, long long> itemWriter(itemStream, compress != 0, 100);
+        for(size_t i = 0; i < items.size(); i++) {
+            itemWriter.write(items[i].first, items[i].second);
+        }
+        itemWriter.finish();
+        std::string bytes = itemStream.str();
+        std::istringstream in(bytes);
+        TreeStreamReader<long long, long long> itemReader(in);
+        std::vector<std::pair<long long, long long> > all, batch;
+        while(!itemReader.done()) {
+            itemReader.read(batch, 77);
+            all.insert(all.end(), batch.begin(), batch.end());
+        }
+        check(all == items, compress ? "compressed stream keeps unsorted 64-bit items"
+                                     : "raw stream keeps unsorted 64-bit items");
+
+        std::string corrupted = bytes;
+        corrupted[sizeof(TreeStreamHeader) + sizeof(TreeStreamChunk) + 5] ^= 0x10;
+        check(!streamIsRejected(bytes) && streamIsRejected(bytes.substr(0, bytes.size() - 4))
+              && streamIsRejected(bytes.substr(0, bytes.size() / 2)) && streamIsRejected(corrupted),
+              "truncated and corrupted streams throw runtime_error");
+    }
+}
+
+// A plain BST that grows a right spine in O(1) per key, so degenerate
+// trees far deeper than sorted inserts could build in time are cheap.
+// Its pool frees the nodes in bulk, without a recursive walk.
+class SpineTree : public BinarySearchTree<int, int, PoolNodeAllocator<> >
+{
+public:
+    SpineTree() : last_(NULL) { }
+
+    void append(int key)
+    {
+        Node<int,int>* node = createNode<Node<int,int> >(key, key, last_);
+        if(last_ == NULL) {
+            root_ = node;
+        }
+        else {
+            last_->setRight(node);
+        }
+        last_ = node;
+        ++size_;
+    }
+
+    const Node<int,int>* root() const { return root_; }
+
+private:
+    Node<int,int>* last_;
+};
+
+// An AVLTree whose root balance can be overwritten with a wrong value.
+class CorruptibleAVLTree : public AVLTree<int,int>
+{
+public:
+    void corruptRootBalance() { static_cast<AVLNode<int,int>*>(root_)->setBalance(2); }
+    const Node<int,int>* root() const { return root_; }
+};
+
+// balanceReport() on empty, degenerate, perfect and AVL trees, and on an
+// AVL tree with a wrong stored balance.
+static void checkBalanceReport()
+{
+    BinarySearchTree<int,int> empty;
+    BinarySearchTree<int,int>::BalanceReport report = empty.balanceReport();
+    check(report.height == -1 && report.worstImbalance == 0 && report.worstNode == NULL
+          && report.badBalanceNode == NULL && empty.isBalanced(), "balanceReport of an empty tree");
+
+    BinarySearchTree<int,int> sorted;
+    for(int key = 0; key < 200; key++) {
+        sorted.insert(std::make_pair(key, key));
+    }
+    report = sorted.balanceReport();
+    check(report.height == 199 && report.worstImbalance == 199 && report.worstNode != NULL
+          && report.worstNode->getKey() == 0 && report.badBalanceNode == NULL && !sorted.isBalanced(),
+          "balanceReport after sorted inserts");
+
+    BinarySearchTree<int,int> perfect;
+    int order[] = { 4, 2, 6, 1, 3, 5, 7 };
+    for(int i = 0; i < 7; i++) {
+        perfect.insert(std::make_pair(order[i], i));
+    }
+    report = perfect.balanceReport();
+    check(report.height == 2 && report.worstImbalance == 0 && perfect.isBalanced(),
+          "balanceReport of a perfect tree");
+
+    // deep enough to overflow the stack of a recursive walk
+    SpineTree spine;
+    for(int key = 0; key < 1000000; key++) {
+        spine.append(key);
+    }
+    SpineTree::BalanceReport spineReport = spine.balanceReport();
+    check(spineReport.height == 999999 && spineReport.worstImbalance == 999999
+          && spineReport.worstNode == spine.root(),
+          "balanceReport walks a million-node spine");
+
+    CorruptibleAVLTree avl;
+    std::mt19937 gen(5);
+    for(int i = 0; i < 1000; i++) {
+        avl.insert(std::make_pair(int(gen() % 100000), i));
+    }
+    report = avl.balanceReport();
+    check(report.height >= 9 && report.height <= 14 && report.worstImbalance <= 1
+          && report.badBalanceNode == NULL && avl.isValidAVL(), "balanceReport of an AVL tree");
+    avl.corruptRootBalance();
+    report = avl.balanceReport();
+    check(report.badBalanceNode == avl.root() && !avl.isValidAVL(), "balanceReport finds a wrong stored balance");
+}
+
+// True iff it is end() exactly when want is expected.end(), and otherwise
+// points at want's key.
+template<typename Tree>
+static bool sameBound(const Tree& tree, typename Tree::iterator it,
+                      const std::map<int,int>& expected, std::map<int,int>::const_iterator want)
+{
+    return want == expected.end() ? it == tree.end() : it != tree.end() && it->first == want->first;
+}
+
+// lowerBound, upperBound, equalRange and range against std::map for hits,
+// misses between keys, and keys below the smallest and above the largest.
+static void checkRangeQueries()
+{
+    AVLTree<int,int> tree;
+    std::map<int,int> expected;
+    std::mt19937 gen(7);
+    for(int i = 0; i < 400; i++) {
+        int key = gen() % 3000;
+        tree.insert(std::make_pair(key, i));
+        expected[key] = i;
+    }
+    bool ok = true;
+    for(int key = -10; key <= 3010 && ok; key++) {
+        std::pair<AVLTree<int,int>::iterator, AVLTree<int,int>::iterator> equal = tree.equalRange(key);
+        ok = sameBound(tree, tree.lowerBound(key), expected, expected.lower_bound(key))
+             && sameBound(tree, tree.upperBound(key), expected, expected.upper_bound(key))
+             && sameBound(tree, equal.first, expected, expected.lower_bound(key))
+             && sameBound(tree, equal.second, expected, expected.upper_bound(key));
+    }
+    check(ok, "lowerBound, upperBound and equalRange match std::map");
+
+    for(int i = 0; i < 500 && ok; i++) {
+        // some queries are empty or inverted, or reach past either end
+        int lo = int(gen() % 3200) - 100;
+        int hi = i % 10 == 0 ? lo : int(gen() % 3200) - 100;
+        std::vector<std::pair<int,int> > visited;
+        size_t count = tree.range(lo, hi, [&visited](const std::pair<const int,int>& item) {
+            visited.push_back(item);
+        });
+        std::vector<std::pair<int,int> > want;
+        if(lo < hi) {
+            want.assign(expected.lower_bound(lo), expected.lower_bound(hi));
+        }
+        ok = count == want.size() && visited == want;
+    }
+    check(ok, "range visits exactly the keys in [lo, hi)");
+}
+
+// A buildFromUnsorted that throws partway must leave the tree as it was
+// and free every node it had made.
+template<typename Tree>
+static void checkFailedBuild(ThreadPool* pool, const char* what)
+{
+    {
+        Tree tree;
+        for(int key = 0; key < 100; key++) {
+            tree.insert(std::make_pair(key, FlakyValue(-key)));
+        }
+        std::vector<std::pair<int, FlakyValue> > items;
+        for(int i = 0; i < 5000; i++) {
+            items.push_back(std::make_pair(i * 7919 % 3000, FlakyValue(i)));
+        }
+        bool threw = false;
+        FlakyValue::copiesLeft = 1000;
+        try {
+            tree.buildFromUnsorted(items.begin(), items.end(), pool);
+        }
+        catch(std::runtime_error&) {
+            threw = true;
+        }
+        FlakyValue::copiesLeft = -1;
+        bool same = tree.size() == 100 && tree.isValidAVL();
+        int key = 0;
+        for(typename Tree::iterator it = tree.begin(); same && it != tree.end(); ++it, ++key) {
+            same = it->first == key && !(it->second != -key);
+        }
+        tree.buildFromUnsorted(items.begin(), items.end(), pool);
+        check(threw && same && tree.size() == 3000 && tree.isValidAVL(), what);
+    }
+    check(FlakyValue::live == 0, what);
+}
+
+// True iff Tree::insertOrAssign accepts a const Key& and a const Value&.
+template<typename Tree, typename Key, typename Value, typename = void>
+struct HasInsertOrAssign : std::false_type { };
+
+template<typename Tree, typename Key, typename Value>
+struct HasInsertOrAssign<Tree, Key, Value, decltype(void(std::declval<Tree&>().insertOrAssign(
+    std::declval<const Key&>(), std::declval<const Value&>())))> : std::true_type { };
+
+static_assert(HasInsertOrAssign<AVLTree<int, std::string>, int, std::string>::value,
+    "insertOrAssign is available for copyable values");
+static_assert(!HasInsertOrAssign<AVLTree<int, std::unique_ptr<int> >, int, std::unique_ptr<int> >::value,
+    "insertOrAssign is rejected at compile time for move-only values");
 
 int main(int argc, char *argv[])
 {
@@ -23,6 +629,10 @@ int main(int argc, char *argv[])
     else {
         cout << "Did not find b" << endl;
     }
+    bt.emplace('c', 3);
+    if(!bt.insertOrAssign('a', 5).second) {
+        cout << "Overwrote a with " << bt['a'] << endl;
+    }
     cout << "Erasing b" << endl;
     bt.remove('b');
 
@@ -43,6 +653,253 @@ int main(int argc, char *argv[])
     }
     cout << "Erasing b" << endl;
     at.remove('b');
+    cout << "AVLTree size: " << at.size() << endl;
+    cout << "AVLTree valid: " << at.isValidAVL() << endl;
+    checkBalanceReport();
+    BinarySearchTree<char,int>& atBase = at;
+    atBase.emplace('c', 3);
+    at.insert(std::make_pair('d', 4));
+    check(at.size() == 3 && at.isValidAVL(), "emplace through a base reference builds AVL nodes");
+
+    // Move-only and heap-owning payloads
+    AVLTree<int, std::unique_ptr<int> > owners;
+    for(int i = 0; i < 100; i++) {
+        owners.insert(std::make_pair(i, std::unique_ptr<int>(new int(i * i))));
+    }
+    owners.insert(std::make_pair(5, std::unique_ptr<int>(new int(-5))));
+    check(owners.emplace(100, std::unique_ptr<int>(new int(7))).second, "emplace of a new unique_ptr");
+    check(!owners.emplace(6, std::unique_ptr<int>(new int(-6))).second, "emplace over an existing key");
+    owners.remove(50);
+    check(owners.size() == 100 && owners.isValidAVL(), "unique_ptr tree shape");
+    check(*owners[5] == -5 && *owners[6] == -6 && *owners[7] == 49 && *owners[100] == 7
+          && owners.find(50) == owners.end(), "unique_ptr values moved in and overwritten");
 
+    AVLTree<std::string, std::string> names;
+    for(int i = 0; i < 100; i++) {
+        std::string key = "key" + std::to_string(i);
+        names.insert(std::make_pair(key, std::string(40, char('a' + i % 26))));
+    }
+    check(!names.insertOrAssign("key7", "seven").second, "insertOrAssign over a string key");
+    names.emplace(std::piecewise_construct, std::forward_as_tuple("key100"), std::forward_as_tuple(3, 'z'));
+    names.remove("key8");
+    std::string previous;
+    bool ordered = true;
+    for(AVLTree<std::string, std::string>::iterator it = names.begin(); it != names.end(); ++it) {
+        ordered = ordered && previous < it->first;
+        previous = it->first;
+    }
+    check(ordered && names.size() == 100 && names.isValidAVL(), "string tree order and shape");
+    check(names["key7"] == "seven" && names["key100"] == "zzz" && names.find("key8") == names.end(),
+          "string values");
+
+    // Pooled node allocation
+    AVLTree<int,int,PoolNodeAllocator<> > pt;
+    for(int i = 0; i < 100; i++) {
+        pt.insert(std::make_pair(i, i*i));
+    }
+    cout << "\nPooled AVLTree 7 -> " << pt.find(7)->second << endl;
+    pt.clear();
+    cout << "Pooled AVLTree empty after clear: " << pt.empty() << endl;
+
+    // Order statistics
+    AVLTree<int,int,HeapNodeAllocator,true> ost;
+    for(int i = 0; i < 100; i += 10) {
+        ost.insert(std::make_pair(i, i));
+    }
+    cout << "3rd smallest key: " << ost.select(2)->first << endl;
+    cout << "Keys below 45: " << ost.rank(45) << endl;
+
+    // Range queries
+    cout << "First key >= 45: " << ost.lowerBound(45)->first << endl;
+    cout << "Keys in [20, 50):";
+    ost.range(20, 50, [](const std::pair<const int,int>& item) {
+        cout << " " << item.first;
+    });
+    cout << endl;
+    checkRangeQueries();
+
+    // Split and join by key range
+    AVLTree<int,int> lower, upper;
+    for(int i = 0; i < 10; i++) {
+        lower.insert(std::make_pair(i, i));
+    }
+    lower.split(6, upper);
+    cout << "Split at 6: " << lower.size() << " below, " << upper.size() << " from 6 up" << endl;
+    check(lower.size() == 6 && upper.size() == 4 && upper.begin()->first == 6, "split at 6");
+    upper.remove(6);
+    lower.join(lower, std::make_pair(6, 60), upper);
+    cout << "Joined back: " << lower.size() << " keys, 6 -> " << lower[6] << endl;
+    check(lower.size() == 10 && lower.isValidAVL() && upper.empty(), "join back");
+
+    // Bulk set operations
+    AVLTree<int,int> evens, threes;
+    for(int i = 0; i < 12; i++) {
+        evens.insert(std::make_pair(2 * i, 0));
+        threes.insert(std::make_pair(3 * i, 1));
+    }
+    ThreadPool pool(2);
+    evens.intersect(threes, &pool);
+    std::vector<std::pair<int,int> > records;
+    records.push_back(std::make_pair(3, 1));
+    records.push_back(std::make_pair(1, 1));
+    records.push_back(std::make_pair(3, 2));
+    AVLTree<int,int> unsorted;
+    unsorted.buildFromUnsorted(records.begin(), records.end(), &pool);
+    cout << "Built from unsorted: " << unsorted.size() << " keys, 3 -> " << unsorted[3] << endl;
+    check(unsorted.size() == 2 && unsorted[3] == 2, "buildFromUnsorted keeps the last duplicate");
+    checkFailedBuild<AVLTree<int, FlakyValue> >(NULL, "failed buildFromUnsorted leaves the tree unchanged");
+    checkFailedBuild<AVLTree<int, FlakyValue, PoolNodeAllocator<> > >(&pool,
+        "failed buildFromUnsorted leaves a pooled tree unchanged");
+    bool rejected = false;
+    try {
+        unsorted.buildFromSorted(records.begin(), records.end());
+    }
+    catch(std::invalid_argument&) {
+        rejected = true;
+    }
+    check(rejected && unsorted.size() == 2 && unsorted[1] == 1 && unsorted.isValidAVL(),
+          "buildFromSorted leaves the tree unchanged on unsorted input");
+    check(evens.size() == 4 && evens.isValidAVL() && threes.empty(), "intersect on a pool");
+    cout << "Multiples of 6:";
+    for(AVLTree<int,int>::iterator it = evens.begin(); it != evens.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Frozen read-only index
+    FrozenIndex<int,int> frozen = ost.freeze();
+    cout << "Frozen index:";
+    for(FrozenIndex<int,int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    cout << "Frozen index has 30: " << (frozen.find(30) != frozen.end()) << endl;
+    checkFrozenIndex<int>("FrozenIndex find and lowerBound with 4-byte keys");
+    checkFrozenIndex<long long>("FrozenIndex find and lowerBound with 8-byte keys");
+
+    // Save to a file and load it back
+    ost.save("bst-test.tree");
+    AVLTree<int,int,HeapNodeAllocator,true> restored;
+    restored.load("bst-test.tree");
+    AVLTree<int,int> viaBase;
+    BinarySearchTree<int,int>& viaBaseRef = viaBase;
+    viaBaseRef.load("bst-test.tree");
+    std::remove("bst-test.tree");
+    viaBase.insert(std::make_pair(5, 5));
+    viaBase.remove(40);
+    check(viaBase.size() == 10 && viaBase.isValidAVL(), "load through a base reference builds AVL nodes");
+    cout << "Restored " << restored.size() << " keys, valid AVL: " << restored.isValidAVL() << endl;
+
+    // Stream a key range out and import it into another tree
+    std::stringstream stream;
+    TreeStreamWriter<int,int> writer(stream, true);
+    ost.exportRange(20, 50, writer);
+    writer.finish();
+    TreeStreamReader<int,int> reader(stream);
+    AVLTree<int,int> imported;
+    imported.import(reader, 2);
+    cout << "Imported [20, 50):";
+    for(AVLTree<int,int>::iterator it = imported.begin(); it != imported.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    checkTreeStream();
+
+    // Tree without parent pointers
+    CompactAVLTree<int,int> compact;
+    for(int i = 1; i <= 7; i++) {
+        compact.insert(std::make_pair(i * 10, i));
+    }
+    compact.remove(40);
+    cout << "Compact tree:";
+    for(CompactAVLTree<int,int>::iterator it = compact.begin(); it != compact.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", height " << compact.height() << ", valid AVL: " << compact.isValidAVL() << endl;
+    checkOrderedTree<CompactAVLTree<int,int> >(5000, 40, "CompactAVLTree random inserts and removes");
+    checkOrderedTree<CompactAVLTree<int,int,PoolNodeAllocator<> > >(5000, 40,
+        "pooled CompactAVLTree random inserts and removes");
+
+    // Tree linked by 32-bit indices; a copy is a snapshot
+    IndexedAVLTree<int,int> indexed;
+    for(int i = 1; i <= 7; i++) {
+        indexed.insert(std::make_pair(i * 10, i));
+    }
+    IndexedAVLTree<int,int> indexedSnapshot(indexed);
+    indexed.remove(40);
+    cout << "Indexed tree:";
+    for(IndexedAVLTree<int,int>::iterator it = indexed.begin(); it != indexed.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", snapshot still has " << indexedSnapshot.size() << " items, valid AVL: " << indexed.isValidAVL() << endl;
+    checkOrderedTree<IndexedAVLTree<int,int> >(5000, 70, "IndexedAVLTree remove-heavy updates");
+    checkIndexedSnapshot();
+
+    // Descending scan
+    cout << "Largest three:";
+    int shown = 0;
+    for(AVLTree<int,int,HeapNodeAllocator,true>::reverse_iterator it = ost.rbegin(); it != ost.rend() && shown < 3; ++it, ++shown) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    check(ost.find(25) == ost.cend() && ost.cend() == ost.find(25), "iterator compares equal to cend()");
+    check(ost.find(20) != ost.cend() && ost.cbegin() == ost.begin(), "iterator compares unequal to cend()");
+    check(ost.crbegin()->first == 90 && ost.crend() != ost.crbegin(), "const reverse iteration");
+
+    // Batched lookup
+    std::vector<int> wanted;
+    wanted.push_back(20);
+    wanted.push_back(25);
+    wanted.push_back(90);
+    std::vector<AVLTree<int,int,HeapNodeAllocator,true>::iterator> hits;
+    ost.findBatch(wanted, hits);
+    cout << "Batch found:";
+    for(size_t i = 0; i < wanted.size(); i++) {
+        cout << " " << wanted[i] << (hits[i] != ost.end() ? "=yes" : "=no");
+    }
+    cout << endl;
+    checkFindBatch();
+
+    // Persistent snapshots
+    PersistentAVLTree<int,int> version1;
+    version1 = version1.insert(std::make_pair(1, 10)).insert(std::make_pair(2, 20));
+    PersistentAVLTree<int,int> snapshot = version1;
+    PersistentAVLTree<int,int> version2 = version1.remove(1).insert(std::make_pair(3, 30));
+    cout << "Snapshot:";
+    for(PersistentAVLTree<int,int>::iterator it = snapshot.begin(); it != snapshot.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", latest:";
+    for(PersistentAVLTree<int,int>::iterator it = version2.begin(); it != version2.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    checkPersistentVersions();
+
+    // B-tree Tests
+    BTree<char,int> bt2;
+    bt2.insert(std::make_pair('a',1));
+    bt2.insert(std::make_pair('b',2));
+
+    cout << "\nBTree contents:" << endl;
+    for(BTree<char,int>::iterator it = bt2.begin(); it != bt2.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    if(bt2.find('b') != bt2.end()) {
+        cout << "Found b" << endl;
+    }
+    else {
+        cout << "Did not find b" << endl;
+    }
+    cout << "Erasing b" << endl;
+    bt2.remove('b');
+    cout << "BTree size: " << bt2.size() << ", a -> " << bt2['a'] << endl;
+    checkBTree<256>("BTree random inserts and removes");
+    checkBTree<64>("BTree random inserts and removes with small nodes");
+
+    if(failures != 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
     return 0;
 }
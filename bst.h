@@ -5,20 +5,46 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <new>
+#include <type_traits>
+#include <string>
+#include <iterator>
+#include <cstddef>
+#include "node-alloc.h"
+#include "frozen-index.h"
+#include "tree-file.h"
+#include "tree-stream.h"
+
+template <typename Key, typename Value, typename Alloc = HeapNodeAllocator>
+class BinarySearchTree;
+
+/**
+ * Tag selecting the node constructors that build the item in place from
+ * arbitrary arguments, the way std::map::emplace does.
+ */
+struct EmplaceTag { };
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are not virtual:
+ * node types for other search trees (Red Black, Splay,
+ * AVL, ...) derive from Node and hide them with versions
+ * returning their own type, which resolves at compile time.
+ * Nodes therefore carry no vtable pointer, and the tree,
+ * which knows its node type, is responsible for destroying
+ * them as the right type (see BinarySearchTree::destroyNode).
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename... Args>
+    Node(EmplaceTag, Node<Key, Value>* parent, Args&&... args);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,9 +52,9 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -36,6 +62,9 @@ public:
     void setValue(const Value &value);
 
 protected:
+    template <typename K, typename V, typename A>
+    friend class BinarySearchTree;
+
     std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
     Node<Key, Value>* left_;
@@ -61,6 +90,21 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Constructs the item in place from args, which are forwarded to the
+* std::pair<const Key, Value> constructor.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(EmplaceTag, Node<Key, Value>* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
@@ -118,7 +162,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -127,7 +171,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +180,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -188,29 +232,54 @@ void Node<Key, Value>::setValue(const Value& value)
 
 /**
 * A templated unbalanced binary search tree.
+* Alloc is the node allocation policy (see node-alloc.h).
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Alloc>
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual void insert(std::pair<const Key, Value>&& keyValuePair);
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+
+    /**
+    * Result of a single-pass balance check. Heights count edges, so an
+    * empty tree has height -1 and a single node height 0.
+    */
+    struct BalanceReport
+    {
+        int height;
+        int worstImbalance;                // max |height(right) - height(left)|
+        Node<Key, Value>* worstNode;       // a node with that imbalance
+        Node<Key, Value>* badBalanceNode;  // first node failing checkStoredBalance
+    };
+    BalanceReport balanceReport() const;
     void print() const;
     bool empty() const;
+    size_t size() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPAlloc>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPAlloc> & tree);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: stepping either way follows parent pointers, a
+    * full scan costing O(1) per step amortized, and --end() reaches the
+    * largest item through the tree the iterator came from.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,17 +289,89 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Alloc>;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Alloc>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Alloc>* tree_;  // for --end(); NULL from makeIterator(node, NULL)
+    };
+
+    /**
+    * An iterator through which the items cannot be modified. Every
+    * iterator converts to one.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        // Non-members, so an iterator converts on either side:
+        // t.find(k) == t.cend() compiles as well as t.cend() == t.find(k).
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.it_ == rhs.it_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.it_ != rhs.it_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        iterator it_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    iterator upperBound(const Key& key) const;
+    std::pair<iterator, iterator> equalRange(const Key& key) const;
+    template<typename Visitor>
+    size_t range(const Key& lo, const Key& hi, Visitor visit) const;
+    FrozenIndex<Key, Value> freeze() const;
+    void save(const std::string& path) const;
+    void load(const std::string& path);
+    size_t exportTo(TreeStreamWriter<Key, Value>& out) const;
+    size_t exportRange(const Key& lo, const Key& hi, TreeStreamWriter<Key, Value>& out) const;
+    size_t import(TreeStreamReader<Key, Value>& in,
+                  size_t batchItems = TreeStreamReader<Key, Value>::DEFAULT_BATCH_ITEMS);
+    void findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+    // Only for a copyable Value; with a move-only one this does not compile.
+    template<typename V = Value>
+    typename std::enable_if<std::is_copy_constructible<V>::value && std::is_copy_assignable<V>::value,
+                            std::pair<iterator, bool> >::type
+    insertOrAssign(const Key& key, const Value& value);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
@@ -238,6 +379,9 @@ protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
+    Node<Key, Value>* getLargestNode() const;
+    Node<Key, Value>* lowerBoundNode(const Key& key) const;
+    Node<Key, Value>* upperBoundNode(const Key& key) const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
@@ -247,13 +391,53 @@ protected:
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
 
     // Add helper functions here
+    static iterator makeIterator(Node<Key, Value>* node, const BinarySearchTree<Key, Value, Alloc>* tree);
+    static void prefetchNode(const Node<Key, Value>* node);
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(Args&&... args);
+    Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>*& parent) const;
+    void linkNode(Node<Key, Value>* parent, Node<Key, Value>* node);
+    virtual void afterInsert(Node<Key, Value>* node);
+
+    // emplace is a template and cannot be overridden, and it builds plain
+    // Nodes in place. A derived tree reached through a base reference
+    // says so here and gets the item moved into its own node type instead.
+    virtual bool buildsPlainNodes() const;
+    virtual std::pair<iterator, bool> insertMoved(std::pair<const Key, Value>&& keyValuePair);
+
+    // The virtual half of insertOrAssign, also behind insert(const&).
+    // Being virtual it is instantiated even when Value is move-only; the
+    // ValueCopyable overloads keep that compiling, and the false one is
+    // only reached by inserting a const pair, which cannot be copied.
+    virtual std::pair<iterator, bool> assignOrInsert(const Key& key, const Value& value);
+    typedef std::integral_constant<bool, std::is_copy_constructible<Value>::value
+        && std::is_copy_assignable<Value>::value> ValueCopyable;
+    template<typename NodeType>
+    std::pair<iterator, bool> assignOrInsertNode(const Key& key, const Value& value, std::true_type);
+    template<typename NodeType>
+    std::pair<iterator, bool> assignOrInsertNode(const Key& key, const Value& value, std::false_type);
+    template<typename NodeType>
+    std::pair<iterator, bool> moveInsertNode(std::pair<const Key, Value>&& keyValuePair);
+    template<typename NodeType, typename... Args>
+    std::pair<iterator, bool> emplaceNode(Args&&... args);
+    virtual void destroyNode(Node<Key, Value>* node);
     void clearHelp(Node<Key, Value>* node);
-    int height(const Node<Key, Value>* node) const;
-    bool checkBalance(const Node<Key, Value>* node) const;
+    // load's node builder, virtual so that a derived tree loaded through a
+    // base reference still builds its own node type. Being virtual it is
+    // instantiated for every tree; the ItemsLoadable overloads keep it
+    // compiling where TreeFile (and so load) cannot be used.
+    virtual Node<Key, Value>* loadSubtree(const Key* keys, const Value* values, size_t count);
+    typedef std::integral_constant<bool, std::is_trivially_copyable<Key>::value
+        && std::is_trivially_copyable<Value>::value> ItemsLoadable;
+    Node<Key, Value>* loadNodes(const Key* keys, const Value* values, size_t count, std::true_type);
+    Node<Key, Value>* loadNodes(const Key* keys, const Value* values, size_t count, std::false_type);
+    virtual bool checkStoredBalance(const Node<Key, Value>* node, int leftHeight, int rightHeight) const;
 
 protected:
     Node<Key, Value>* root_;
     // You should not need other data members
+    Alloc alloc_;
+    size_t size_;
 };
 
 /*
@@ -265,30 +449,33 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::iterator::iterator(Node<Key,Value> *ptr,
+                                                        const BinarySearchTree<Key, Value, Alloc>* tree)
 {
     // TODO
     current_ = ptr;
+    tree_ = tree;
 
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::iterator::iterator() 
 {
     // TODO
     current_ = NULL;
+    tree_ = NULL;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -296,9 +483,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -307,10 +494,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Alloc>::iterator& rhs) const
 {
     // TODO
     if (current_ == rhs.current_){
@@ -323,10 +510,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Alloc>::iterator& rhs) const
 {
     // TODO
     if (current_ != rhs.current_){
@@ -339,9 +526,9 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator&
+BinarySearchTree<Key, Value, Alloc>::iterator::operator++()
 {
     // TODO
     if (current_->right_ != NULL){
@@ -361,6 +548,40 @@ BinarySearchTree<Key, Value>::iterator::operator++()
     return *this;
 }
 
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/**
+* Steps back to the in-order predecessor; from end() to the largest item.
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator&
+BinarySearchTree<Key, Value, Alloc>::iterator::operator--()
+{
+    if (current_ == NULL){
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --*this;
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -368,6 +589,79 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+-------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::const_iterator::const_iterator()
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::const_iterator::const_iterator(const iterator& it) :
+    it_(it)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Alloc>::const_iterator::operator*() const
+{
+    return *it_;
+}
+
+template<class Key, class Value, class Alloc>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Alloc>::const_iterator::operator->() const
+{
+    return it_.operator->();
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_iterator&
+BinarySearchTree<Key, Value, Alloc>::const_iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Alloc>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++it_;
+    return old;
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_iterator&
+BinarySearchTree<Key, Value, Alloc>::const_iterator::operator--()
+{
+    --it_;
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Alloc>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --it_;
+    return old;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+-----------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -377,15 +671,16 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::BinarySearchTree() 
 {
     // TODO
     this->root_ = NULL;
+    size_ = 0;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+template<typename Key, typename Value, typename Alloc>
+BinarySearchTree<Key, Value, Alloc>::~BinarySearchTree()
 {
     // TODO
     clear();
@@ -394,14 +689,23 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+ * Returns the number of items in the tree, in constant time
+*/
+template<class Key, class Value, class Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -410,51 +714,305 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Alloc>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Alloc>::iterator end(NULL, this);
     return end;
 }
 
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Alloc>::cbegin() const
+{
+    return begin();
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Alloc>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the largest item; reverse iterators walk
+* the items in descending key order.
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Alloc>::iterator it(curr, this);
     return it;
 }
 
+/**
+* Returns an iterator to the first item whose key is not less than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::lowerBound(const Key & k) const
+{
+    return iterator(lowerBoundNode(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::upperBound(const Key & k) const
+{
+    return iterator(upperBoundNode(k), this);
+}
+
+/**
+* Returns the [lowerBound(k), upperBound(k)) pair; since keys are unique
+* it holds at most one item
+*/
+template<class Key, class Value, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc>::iterator>
+BinarySearchTree<Key, Value, Alloc>::equalRange(const Key & k) const
+{
+    Node<Key, Value>* first = lowerBoundNode(k);
+    if (first != NULL && !(k < first->getKey())){
+        iterator last(first, this);
+        ++last;
+        return std::make_pair(iterator(first, this), last);
+    }
+    return std::make_pair(iterator(first, this), iterator(first, this));
+}
+
+/**
+* Calls visit(item) on every item with lo <= key < hi, in order, and
+* returns how many were visited. Descends straight to lo and stops at
+* hi, so a query costs O(log n + k).
+*/
+template<class Key, class Value, class Alloc>
+template<typename Visitor>
+size_t BinarySearchTree<Key, Value, Alloc>::range(const Key & lo, const Key & hi, Visitor visit) const
+{
+    size_t visited = 0;
+    for (iterator it(lowerBoundNode(lo), this); it != end() && it->first < hi; ++it){
+        visit(*it);
+        ++visited;
+    }
+    return visited;
+}
+
+/**
+* Asks the cache for a node ahead of its use; a no-op for NULL or on
+* compilers without a prefetch builtin.
+*/
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::prefetchNode(const Node<Key, Value>* node)
+{
+#if defined(__GNUC__)
+    if (node != NULL){
+        __builtin_prefetch(node);
+    }
+#else
+    (void)node;
+#endif
+}
+
+/**
+* Copies the tree into an immutable FrozenIndex for read-only lookups.
+* The tree itself is left unchanged.
+*/
+template<class Key, class Value, class Alloc>
+FrozenIndex<Key, Value> BinarySearchTree<Key, Value, Alloc>::freeze() const
+{
+    return FrozenIndex<Key, Value>(begin(), end(), size_);
+}
+
+/**
+* Writes the items to a tree file at path (see tree-file.h), in key
+* order, replacing any file there. Key and Value must be trivially
+* copyable. Throws std::runtime_error on I/O errors.
+*/
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::save(const std::string& path) const
+{
+    TreeFile<Key, Value>::write(path, begin(), end(), size_);
+}
+
+/**
+* Replaces the contents of the tree with those of a file written by save.
+* The file is mapped and validated first, and the nodes are built from it
+* in one in-order pass as a balanced tree, without searching: O(n).
+* Throws std::runtime_error, leaving the tree unchanged, if the file
+* cannot be read or is damaged.
+*/
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::load(const std::string& path)
+{
+    TreeFile<Key, Value> file(path);
+    clear();
+    root_ = loadSubtree(file.keys(), file.values(), file.size());
+    size_ = file.size();
+}
+
+/**
+* Writes every item to out in key order and returns how many. The items
+* go through out's chunk buffer, so nothing else is copied; out is not
+* finished, so several exports can share one stream.
+*/
+template<class Key, class Value, class Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::exportTo(TreeStreamWriter<Key, Value>& out) const
+{
+    for (iterator it = begin(); it != end(); ++it){
+        out.write(*it);
+    }
+    return size_;
+}
+
+/**
+* Like exportTo, but only the items with lo <= key < hi.
+*/
+template<class Key, class Value, class Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::exportRange(const Key& lo, const Key& hi,
+                                                        TreeStreamWriter<Key, Value>& out) const
+{
+    return range(lo, hi, [&out](const std::pair<const Key, Value>& item) { out.write(item); });
+}
+
+/**
+* Inserts everything left in a tree stream, reading it batchItems items
+* at a time, so only one batch is held in memory however long the stream
+* is. Items are inserted in stream order: a repeated key ends up with its
+* last value. Returns how many items were read.
+*/
+template<class Key, class Value, class Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::import(TreeStreamReader<Key, Value>& in, size_t batchItems)
+{
+    std::vector<std::pair<Key, Value> > batch;
+    size_t total = 0;
+    while (in.read(batch, batchItems) != 0){
+        for (size_t i = 0; i < batch.size(); ++i){
+            assignOrInsert(batch[i].first, batch[i].second);
+        }
+        total += batch.size();
+    }
+    return total;
+}
+
+/**
+* Looks up every key in keys and stores the results in out (resized to
+* match), end() for keys that are missing.
+*
+* A single find stalls on a cache miss at nearly every level. Here up to
+* FIND_BATCH_GROUP lookups are in flight at once: each round advances
+* every lookup by one level and prefetches the node it moves to, so by
+* the time a lookup is visited again its node has usually arrived and the
+* misses of the whole group overlap. A finished lookup's slot is refilled
+* with the next key straight away.
+*/
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    const size_t FIND_BATCH_GROUP = 16;
+    Node<Key, Value>* current[FIND_BATCH_GROUP];
+    size_t index[FIND_BATCH_GROUP];
+    size_t next = 0;
+    size_t active = 0;
+
+    out.resize(keys.size());
+    for (; active < FIND_BATCH_GROUP && next < keys.size(); ++active, ++next){
+        current[active] = root_;
+        index[active] = next;
+    }
+
+    while (active > 0){
+        for (size_t slot = 0; slot < active; ){
+            Node<Key, Value>* curr = current[slot];
+            const Key& key = keys[index[slot]];
+            if (curr != NULL && !(key == curr->getKey())){
+                curr = key < curr->getKey() ? curr->getLeft() : curr->getRight();
+                prefetchNode(curr);
+                current[slot] = curr;
+                ++slot;
+                continue;
+            }
+
+            out[index[slot]] = iterator(curr, this);
+            if (next < keys.size()){
+                current[slot] = root_;
+                index[slot] = next++;
+                ++slot;
+            }
+            else {
+                // keep the in-flight lookups packed at the front
+                --active;
+                current[slot] = current[active];
+                index[slot] = index[active];
+            }
+        }
+    }
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Alloc>
+Value& BinarySearchTree<Key, Value, Alloc>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Alloc>
+Value const & BinarySearchTree<Key, Value, Alloc>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
@@ -467,43 +1025,79 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
     // TODO
-    Node<Key, Value>* node = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
+    assignOrInsert(keyValuePair.first, keyValuePair.second);
+}
 
-    Node<Key, Value>* curr = root_;
-    Node<Key, Value>* parent = NULL;
+/**
+* Moves the pair into the tree; the value is moved, never copied.
+*/
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    insertMoved(std::move(keyValuePair));
+}
 
-    while (curr != NULL){
-        parent = curr;
+/**
+* Like insert with an rvalue, but returns where the item went and
+* whether it was new.
+*/
+template<class Key, class Value, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::insertMoved(std::pair<const Key, Value>&& keyValuePair)
+{
+    return moveInsertNode<Node<Key, Value> >(std::move(keyValuePair));
+}
 
-        if (node->item_.first < curr->item_.first){
-            curr = curr->left_;
-        }
-        else if (node->item_.first > curr->item_.first){
-            curr = curr->right_;
-        }
-        else {
-            curr->item_.second = node->item_.second;
-            delete node;
-            return;
-        }
-    }
-        
-    node->parent_ = parent;
+template<class Key, class Value, class Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::buildsPlainNodes() const
+{
+    return true;
+}
 
-    if (parent == NULL){
-        root_ = node;
-    }
-    else if (node->item_.first < parent->item_.first){
-        parent->left_ = node;
-    }
-    else {
-        parent->right_ = node;
-    }
+/**
+* Searches for key first and only allocates a node when it is missing.
+* An existing key has its value overwritten in place.
+* Returns an iterator to the key's node and true iff a node was inserted.
+*/
+template<class Key, class Value, class Alloc>
+template<typename V>
+typename std::enable_if<std::is_copy_constructible<V>::value && std::is_copy_assignable<V>::value,
+                        std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool> >::type
+BinarySearchTree<Key, Value, Alloc>::insertOrAssign(const Key& key, const Value& value)
+{
+    return assignOrInsert(key, value);
+}
+
+template<class Key, class Value, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::assignOrInsert(const Key& key, const Value& value)
+{
+    return assignOrInsertNode<Node<Key, Value> >(key, value, ValueCopyable());
+}
 
+/**
+* Builds the item in place inside a new node from args (anything the
+* std::pair<const Key, Value> constructor accepts, including
+* std::piecewise_construct). Like insert, an existing key has its value
+* replaced, here by moving it out of the new item.
+*
+* Called through a base reference on a derived tree, the item is built
+* on the stack and moved into the tree's own node type, so it must be
+* move constructible there.
+*/
+template<class Key, class Value, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::emplace(Args&&... args)
+{
+    if (!buildsPlainNodes()){
+        return insertMoved(std::pair<const Key, Value>(std::forward<Args>(args)...));
+    }
+    return emplaceNode<Node<Key, Value> >(std::forward<Args>(args)...);
 }
 
 
@@ -512,8 +1106,8 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::remove(const Key& key)
 {
 
     //find the node to remove
@@ -545,7 +1139,8 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         }
         // break connection with parent node
         (node->parent_) = NULL;
-        delete node;
+        destroyNode(node);
+        --size_;
         return;
     }
 
@@ -584,7 +1179,8 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             (node->parent_)->right_ = child;
         }
         child->parent_ = node->parent_;
-        delete node;
+        destroyNode(node);
+        --size_;
         return;
     }
     else if (node != NULL && node->right_ != NULL){
@@ -599,7 +1195,8 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             (node->parent_)->right_ = child;
         }
         child->parent_ = node->parent_;
-        delete node;
+        destroyNode(node);
+        --size_;
         return;
     }
     
@@ -650,7 +1247,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         delete temp;
     }
     else {
-        Node<Key, Value>* predecessor = BinarySearchTree<Key, Value>::predecessor(temp);
+        Node<Key, Value>* predecessor = BinarySearchTree<Key, Value, Alloc>::predecessor(temp);
         nodeSwap(temp, predecessor);
         remove(key);
     }
@@ -798,9 +1395,9 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 
 
 
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Alloc>::predecessor(Node<Key, Value>* current)
 {
     // TODO
     
@@ -851,33 +1448,264 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::clear()
 {
     // TODO
-    clearHelp(root_);
+    // A pool can drop all of its blocks at once; the per-node walk is only
+    // needed when the node destructors actually have work to do.
+    if (!Alloc::bulkRelease || !std::is_trivially_destructible<Key>::value
+            || !std::is_trivially_destructible<Value>::value){
+        clearHelp(root_);
+    }
+    if (Alloc::bulkRelease){
+        alloc_.release();
+    }
     root_ = NULL;
+    size_ = 0;
     return;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelp(Node<Key,Value>* node){
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::clearHelp(Node<Key,Value>* node){
     if (node == NULL){
         return;
     }
     clearHelp(node->getLeft());
     clearHelp(node->getRight());
-    delete node;
+    destroyNode(node);
     return;
 }
 
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::loadSubtree(const Key* keys, const Value* values, size_t count)
+{
+    return loadNodes(keys, values, count, ItemsLoadable());
+}
+
+/**
+* Builds a balanced subtree from the count items in keys and values,
+* which are in ascending key order: the left half, then the middle node,
+* then the right half, so the items are read front to back.
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::loadNodes(const Key* keys, const Value* values, size_t count,
+                                                                 std::true_type)
+{
+    if (count == 0){
+        return NULL;
+    }
+    size_t leftCount = count / 2;
+    Node<Key, Value>* left = loadNodes(keys, values, leftCount, std::true_type());
+    Node<Key, Value>* node = NULL;
+    Node<Key, Value>* right = NULL;
+    try {
+        node = createNode<Node<Key, Value> >(EmplaceTag(), static_cast<Node<Key, Value>*>(NULL),
+                                             keys[leftCount], values[leftCount]);
+        right = loadNodes(keys + leftCount + 1, values + leftCount + 1, count - leftCount - 1, std::true_type());
+    }
+    catch (...) {
+        clearHelp(left);
+        if (node != NULL){
+            destroyNode(node);
+        }
+        throw;
+    }
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != NULL){
+        left->setParent(node);
+    }
+    if (right != NULL){
+        right->setParent(node);
+    }
+    return node;
+}
+
+/**
+* Never called: load cannot be instantiated for these items.
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::loadNodes(const Key* keys, const Value* values, size_t count,
+                                                                 std::false_type)
+{
+    throw std::logic_error("load needs trivially copyable Key and Value");
+}
+
+/**
+* Wraps a node in an iterator; lets derived trees use the protected constructor.
+* tree may be NULL for an iterator that is never decremented from end().
+*/
+template<typename Key, typename Value, typename Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::makeIterator(Node<Key, Value>* node,
+                                                  const BinarySearchTree<Key, Value, Alloc>* tree)
+{
+    return iterator(node, tree);
+}
+
+/**
+* Constructs a node of the requested type in storage from the allocator.
+*/
+template<typename Key, typename Value, typename Alloc>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Alloc>::createNode(Args&&... args)
+{
+    void* mem = alloc_.allocate(sizeof(NodeType));
+    try {
+        return new (mem) NodeType(std::forward<Args>(args)...);
+    }
+    catch (...) {
+        alloc_.deallocate(mem);
+        throw;
+    }
+}
+
+/**
+* Returns the node holding key, or NULL after setting parent to the
+* node a new key would hang from (NULL for an empty tree).
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::findSlot(const Key& key, Node<Key, Value>*& parent) const
+{
+    Node<Key, Value>* curr = root_;
+    parent = NULL;
+
+    while (curr != NULL){
+        if (key < curr->item_.first){
+            parent = curr;
+            curr = curr->left_;
+        }
+        else if (key > curr->item_.first){
+            parent = curr;
+            curr = curr->right_;
+        }
+        else {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Hangs a fresh node off the parent found by findSlot and lets the
+* tree rebalance.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::linkNode(Node<Key, Value>* parent, Node<Key, Value>* node)
+{
+    node->parent_ = parent;
+
+    if (parent == NULL){
+        root_ = node;
+    }
+    else if (node->item_.first < parent->item_.first){
+        parent->left_ = node;
+    }
+    else {
+        parent->right_ = node;
+    }
+    ++size_;
+    afterInsert(node);
+}
+
+/**
+* Called once a new node is linked in. A plain BST does not rebalance.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::afterInsert(Node<Key, Value>* node)
+{
+
+}
+
+template<typename Key, typename Value, typename Alloc>
+template<typename NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::assignOrInsertNode(const Key& key, const Value& value, std::true_type)
+{
+    Node<Key, Value>* parent;
+    Node<Key, Value>* curr = findSlot(key, parent);
+    if (curr != NULL){
+        curr->item_.second = value;
+        return std::make_pair(iterator(curr, this), false);
+    }
+
+    NodeType* node = createNode<NodeType>(key, value, static_cast<NodeType*>(NULL));
+    linkNode(parent, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+template<typename Key, typename Value, typename Alloc>
+template<typename NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::assignOrInsertNode(const Key& key, const Value& value, std::false_type)
+{
+    throw std::logic_error("Value is not copyable; insert an rvalue or use emplace");
+}
+
+/**
+* Search-first insert that moves the value into either the existing node
+* or a new one.
+*/
+template<typename Key, typename Value, typename Alloc>
+template<typename NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::moveInsertNode(std::pair<const Key, Value>&& keyValuePair)
+{
+    Node<Key, Value>* parent;
+    Node<Key, Value>* curr = findSlot(keyValuePair.first, parent);
+    if (curr != NULL){
+        curr->item_.second = std::move(keyValuePair.second);
+        return std::make_pair(iterator(curr, this), false);
+    }
+
+    NodeType* node = createNode<NodeType>(EmplaceTag(), static_cast<NodeType*>(NULL), std::move(keyValuePair));
+    linkNode(parent, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Unlike the insert paths this has to build the node before it can see
+* the key, so a hit costs one allocation.
+*/
+template<typename Key, typename Value, typename Alloc>
+template<typename NodeType, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc>::emplaceNode(Args&&... args)
+{
+    NodeType* node = createNode<NodeType>(EmplaceTag(), static_cast<NodeType*>(NULL), std::forward<Args>(args)...);
+
+    Node<Key, Value>* parent;
+    Node<Key, Value>* curr = findSlot(node->getKey(), parent);
+    if (curr != NULL){
+        curr->item_.second = std::move(node->item_.second);
+        destroyNode(node);
+        return std::make_pair(iterator(curr, this), false);
+    }
+
+    linkNode(parent, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Runs the node destructor and returns the storage to the allocator.
+* Trees with their own node type override this to destroy it as that type;
+* node types use single inheritance, so the base pointer is the block address.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    node->~Node();
+    alloc_.deallocate(node);
+}
+
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Alloc>::getSmallestNode() const
 {
     // TODO
     if (root_ == NULL){
@@ -892,13 +1720,66 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
     return curr;
 }
 
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc>::getLargestNode() const
+{
+    Node<Key, Value>* curr = root_;
+    while (curr != NULL && curr->getRight() != NULL){
+        curr = curr->getRight();
+    }
+    return curr;
+}
+
+/**
+* Helper function returning the first node whose key is not less than key,
+* or NULL if there is none
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::lowerBoundNode(const Key& key) const
+{
+    Node<Key, Value>* curr = root_;
+    Node<Key, Value>* best = NULL;
+    while (curr != NULL){
+        if (curr->item_.first < key){
+            curr = curr->right_;
+        }
+        else {
+            best = curr;
+            curr = curr->left_;
+        }
+    }
+    return best;
+}
+
+/**
+* Helper function returning the first node whose key is greater than key,
+* or NULL if there is none
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::upperBoundNode(const Key& key) const
+{
+    Node<Key, Value>* curr = root_;
+    Node<Key, Value>* best = NULL;
+    while (curr != NULL){
+        if (key < curr->item_.first){
+            best = curr;
+            curr = curr->left_;
+        }
+        else {
+            curr = curr->right_;
+        }
+    }
+    return best;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::internalFind(const Key& key) const
 {
     // TODO
     Node<Key, Value>* curr = root_;
@@ -919,38 +1800,91 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::isBalanced() const
 {
     // TODO
-    return checkBalance(root_);
+    return balanceReport().worstImbalance <= 1;
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::checkBalance(const Node<Key, Value>* node) const{
-    if (node == NULL){
-        return true;
+/**
+ * Computes every subtree height once in an iterative post-order walk,
+ * so it runs in O(n) time and uses a heap-allocated stack that cannot
+ * overflow on degenerate trees.
+ */
+template<typename Key, typename Value, typename Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::BalanceReport
+BinarySearchTree<Key, Value, Alloc>::balanceReport() const
+{
+    BalanceReport report;
+    report.height = -1;
+    report.worstImbalance = 0;
+    report.worstNode = NULL;
+    report.badBalanceNode = NULL;
+
+    std::vector<Node<Key, Value>*> path;
+    std::vector<int> heights;   // finished subtrees, left before right
+    Node<Key, Value>* curr = root_;
+    Node<Key, Value>* last = NULL;
+
+    while (curr != NULL || !path.empty()){
+        if (curr != NULL){
+            path.push_back(curr);
+            curr = curr->left_;
+            continue;
+        }
+
+        Node<Key, Value>* top = path.back();
+        if (top->right_ != NULL && last != top->right_){
+            curr = top->right_;
+            continue;
+        }
+
+        int right = -1;
+        int left = -1;
+        if (top->right_ != NULL){
+            right = heights.back();
+            heights.pop_back();
+        }
+        if (top->left_ != NULL){
+            left = heights.back();
+            heights.pop_back();
+        }
+
+        int imbalance = abs(right - left);
+        if (imbalance > report.worstImbalance || report.worstNode == NULL){
+            report.worstImbalance = imbalance;
+            report.worstNode = top;
+        }
+        if (report.badBalanceNode == NULL && !checkStoredBalance(top, left, right)){
+            report.badBalanceNode = top;
+        }
+
+        heights.push_back(1 + std::max(left, right));
+        last = top;
+        path.pop_back();
     }
-    int left = height(node->getLeft());
-    int right = height(node->getRight());
-    if(abs(left - right) > 1){
-        return false;
+
+    if (!heights.empty()){
+        report.height = heights.back();
     }
-    return (checkBalance(node->getLeft()) && checkBalance(node->getRight()));
+    return report;
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::height(const Node<Key, Value>* node) const{
-    if (node == NULL){
-        return -1;
-    }
-    return 1 + std::max(height(node->left_),height(node->right_));
+/**
+ * Lets a balanced tree compare the balance it stores in a node with the
+ * real subtree heights. A plain BST stores nothing, so nothing can be wrong.
+ */
+template<typename Key, typename Value, typename Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::checkStoredBalance(const Node<Key, Value>* node, int leftHeight, int rightHeight) const
+{
+    return true;
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
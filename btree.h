@@ -0,0 +1,764 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <iostream>
+#include <cstdlib>
+#include <utility>
+#include <stdexcept>
+#include <new>
+#include <type_traits>
+#include "key-search.h"
+
+/**
+* A B+tree ordered map with the same interface as BinarySearchTree.
+*
+* Each node holds many keys, sized so a node spans NodeBytes (a few cache
+* lines). Inner nodes hold only separator keys and child pointers, so a
+* lookup touches one node per level and the tree is log_B(n) levels deep
+* instead of log_2(n). All items live in the leaves, which are chained
+* left to right for iteration.
+*
+* Key must be default constructible and copy assignable (inner nodes keep
+* plain arrays of separators) and Value must be copyable. Like the other
+* trees, insert overwrites the value of an existing key and operator[]
+* requires the key to be present.
+*
+* Iterators stay valid until the next insert or remove, which may move
+* items between leaves.
+*/
+template <typename Key, typename Value, size_t NodeBytes = 256>
+class BTree
+{
+protected:
+    typedef std::pair<const Key, Value> Item;
+
+public:
+    // Most items a leaf / separators an inner node can hold (at least 4).
+    static const size_t LEAF_CAPACITY =
+        NodeBytes / sizeof(Item) < 4 ? 4 : NodeBytes / sizeof(Item);
+    static const size_t INNER_CAPACITY =
+        NodeBytes / (sizeof(Key) + sizeof(void*)) < 4 ? 4 : NodeBytes / (sizeof(Key) + sizeof(void*));
+
+    static_assert(LEAF_CAPACITY <= 65535 && INNER_CAPACITY <= 65535,
+        "node counts are stored in 16 bits");
+
+    BTree();
+    ~BTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+protected:
+    struct NodeBase
+    {
+        bool isLeaf;
+        unsigned short count;   // items in a leaf, separators in an inner node
+    };
+
+    struct LeafNode : NodeBase
+    {
+        LeafNode* next;
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type slots[LEAF_CAPACITY];
+
+        Item& item(size_t i) { return *reinterpret_cast<Item*>(&slots[i]); }
+        const Item& item(size_t i) const { return *reinterpret_cast<const Item*>(&slots[i]); }
+    };
+
+    // Separator slots, padded so KeySearch can read whole vectors. Inner
+    // nodes are value-initialized, so the padding is never uninitialized.
+    static const size_t KEY_SLOTS =
+        (INNER_CAPACITY + KeySearch<Key>::LANES - 1) / KeySearch<Key>::LANES * KeySearch<Key>::LANES;
+
+    // children[i] holds the keys k with keys[i-1] <= k < keys[i].
+    struct InnerNode : NodeBase
+    {
+        Key keys[KEY_SLOTS];
+        NodeBase* children[INNER_CAPACITY + 1];
+    };
+
+public:
+    /**
+    * Walks the items in key order along the leaf chain.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class BTree<Key, Value, NodeBytes>;
+        iterator(LeafNode* leaf, size_t index);
+        LeafNode* leaf_;
+        size_t index_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    std::pair<iterator, bool> insertOrAssign(const Key& key, const Value& value);
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    // Where an insert below a node put the item, and the node's new right
+    // sibling with its first key if the node had to split.
+    struct InsertResult
+    {
+        LeafNode* leaf;
+        size_t index;
+        bool inserted;
+        NodeBase* split;
+        Key splitKey;
+    };
+
+    static size_t leafSlot(const LeafNode* leaf, const Key& key);
+    static size_t innerSlot(const InnerNode* inner, const Key& key);
+    static void moveItem(LeafNode* from, size_t i, LeafNode* to, size_t j);
+    const LeafNode* findLeaf(const Key& key) const;
+    static void prefetchNode(const NodeBase* node);
+
+    InsertResult insertBelow(NodeBase* node, const Key& key, const Value& value);
+    InsertResult insertIntoLeaf(LeafNode* leaf, size_t i, const Key& key, const Value& value);
+    void insertIntoInner(InnerNode* inner, size_t i, InsertResult& result);
+    bool removeBelow(NodeBase* node, const Key& key);
+    void fixUnderflow(InnerNode* parent, size_t c);
+    void mergeChildren(InnerNode* parent, size_t c);
+    static size_t minCount(const NodeBase* node);
+    void clearHelp(NodeBase* node);
+
+protected:
+    NodeBase* root_;
+    LeafNode* first_;
+    size_t size_;
+
+private:
+    BTree(const BTree&);
+    BTree& operator=(const BTree&);
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the BTree::iterator class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value, size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::iterator::iterator() :
+    leaf_(NULL),
+    index_(0)
+{
+
+}
+
+template<class Key, class Value, size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::iterator::iterator(LeafNode* leaf, size_t index) :
+    leaf_(leaf),
+    index_(index)
+{
+
+}
+
+template<class Key, class Value, size_t NodeBytes>
+std::pair<const Key,Value> &
+BTree<Key, Value, NodeBytes>::iterator::operator*() const
+{
+    return leaf_->item(index_);
+}
+
+template<class Key, class Value, size_t NodeBytes>
+std::pair<const Key,Value> *
+BTree<Key, Value, NodeBytes>::iterator::operator->() const
+{
+    return &(leaf_->item(index_));
+}
+
+template<class Key, class Value, size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Steps to the next item in the leaf, or the first item of the next leaf.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator&
+BTree<Key, Value, NodeBytes>::iterator::operator++()
+{
+    if (++index_ == leaf_->count){
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+/*
+-----------------------------------------------
+End implementations for the BTree::iterator class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the BTree class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value, size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::BTree() :
+    root_(NULL),
+    first_(NULL),
+    size_(0)
+{
+
+}
+
+template<class Key, class Value, size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::~BTree()
+{
+    clear();
+}
+
+template<class Key, class Value, size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value, size_t NodeBytes>
+size_t BTree<Key, Value, NodeBytes>::size() const
+{
+    return size_;
+}
+
+/**
+* Number of inner levels above the leaves; -1 for an empty tree.
+*/
+template<class Key, class Value, size_t NodeBytes>
+int BTree<Key, Value, NodeBytes>::height() const
+{
+    int h = -1;
+    for (const NodeBase* node = root_; node != NULL; ++h){
+        node = node->isLeaf ? NULL : static_cast<const InnerNode*>(node)->children[0];
+    }
+    return h;
+}
+
+template<class Key, class Value, size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator
+BTree<Key, Value, NodeBytes>::begin() const
+{
+    return iterator(first_, 0);
+}
+
+template<class Key, class Value, size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator
+BTree<Key, Value, NodeBytes>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the key's item, or end() if it is not present.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator
+BTree<Key, Value, NodeBytes>::find(const Key& key) const
+{
+    const LeafNode* leaf = findLeaf(key);
+    if (leaf == NULL){
+        return end();
+    }
+    size_t i = leafSlot(leaf, key);
+    if (i == leaf->count || key < leaf->item(i).first){
+        return end();
+    }
+    return iterator(const_cast<LeafNode*>(leaf), i);
+}
+
+/**
+* @precondition The key exists in the map
+* Returns the value associated with the key
+*/
+template<class Key, class Value, size_t NodeBytes>
+Value& BTree<Key, Value, NodeBytes>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, size_t NodeBytes>
+Value const & BTree<Key, Value, NodeBytes>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    insertOrAssign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Inserts key with value, or overwrites the value of an existing key.
+* Returns an iterator to the item and true iff a new item was inserted.
+*/
+template<class Key, class Value, size_t NodeBytes>
+std::pair<typename BTree<Key, Value, NodeBytes>::iterator, bool>
+BTree<Key, Value, NodeBytes>::insertOrAssign(const Key& key, const Value& value)
+{
+    if (root_ == NULL){
+        LeafNode* leaf = new LeafNode;
+        leaf->isLeaf = true;
+        leaf->count = 0;
+        leaf->next = NULL;
+        root_ = first_ = leaf;
+    }
+
+    InsertResult result = insertBelow(root_, key, value);
+    if (result.split != NULL){
+        // the root split: grow the tree by one level
+        InnerNode* root = new InnerNode();
+        root->isLeaf = false;
+        root->count = 1;
+        root->keys[0] = result.splitKey;
+        root->children[0] = root_;
+        root->children[1] = result.split;
+        root_ = root;
+    }
+    if (result.inserted){
+        ++size_;
+    }
+    return std::make_pair(iterator(result.leaf, result.index), result.inserted);
+}
+
+/**
+* Removes the key if present. Nodes that drop below half full borrow from
+* or merge with a sibling on the way back up.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::remove(const Key& key)
+{
+    if (root_ == NULL || !removeBelow(root_, key)){
+        return;
+    }
+    --size_;
+
+    if (root_->isLeaf){
+        if (root_->count == 0){
+            delete static_cast<LeafNode*>(root_);
+            root_ = NULL;
+            first_ = NULL;
+        }
+    }
+    else if (root_->count == 0){
+        // the root's last two children merged: drop a level
+        InnerNode* old = static_cast<InnerNode*>(root_);
+        root_ = old->children[0];
+        delete old;
+    }
+}
+
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::clear()
+{
+    clearHelp(root_);
+    root_ = NULL;
+    first_ = NULL;
+    size_ = 0;
+}
+
+/**
+* Index of the first item in the leaf whose key is not less than key.
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BTree<Key, Value, NodeBytes>::leafSlot(const LeafNode* leaf, const Key& key)
+{
+    // Halve the range with a select instead of a branch: the outcome of
+    // each comparison is random, so a branch would mispredict half the time.
+    size_t base = 0;
+    size_t n = leaf->count;
+    if (n == 0){
+        return 0;
+    }
+    while (n > 1){
+        size_t half = n / 2;
+        base = leaf->item(base + half - 1).first < key ? base + half : base;
+        n -= half;
+    }
+    return base + (leaf->item(base).first < key);
+}
+
+/**
+* Index of the child whose range holds key: the number of separators
+* that are not greater than key. Integral keys are compared a vector at a
+* time (see key-search.h).
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BTree<Key, Value, NodeBytes>::innerSlot(const InnerNode* inner, const Key& key)
+{
+    return KeySearch<Key>::template upperBound<KEY_SLOTS>(inner->keys, inner->count, key);
+}
+
+/**
+* Moves the item in slot i of one leaf into the empty slot j of another
+* (or the same) leaf.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::moveItem(LeafNode* from, size_t i, LeafNode* to, size_t j)
+{
+    new (&to->slots[j]) Item(std::move(from->item(i)));
+    from->item(i).~Item();
+}
+
+template<class Key, class Value, size_t NodeBytes>
+const typename BTree<Key, Value, NodeBytes>::LeafNode*
+BTree<Key, Value, NodeBytes>::findLeaf(const Key& key) const
+{
+    const NodeBase* node = root_;
+    if (node == NULL){
+        return NULL;
+    }
+    while (!node->isLeaf){
+        const InnerNode* inner = static_cast<const InnerNode*>(node);
+        node = inner->children[innerSlot(inner, key)];
+        prefetchNode(node);
+    }
+    return static_cast<const LeafNode*>(node);
+}
+
+/**
+* Requests every cache line of a node at once. A binary search over a
+* multi-line node otherwise waits for each line it probes in turn, which
+* would cost as many misses per level as the binary tree it replaces.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::prefetchNode(const NodeBase* node)
+{
+#if defined(__GNUC__)
+    const size_t bytes = sizeof(LeafNode) > sizeof(InnerNode) ? sizeof(LeafNode) : sizeof(InnerNode);
+    const char* p = reinterpret_cast<const char*>(node);
+    for (size_t offset = 0; offset < bytes; offset += 64){
+        __builtin_prefetch(p + offset);
+    }
+#else
+    (void)node;
+#endif
+}
+
+template<class Key, class Value, size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::InsertResult
+BTree<Key, Value, NodeBytes>::insertBelow(NodeBase* node, const Key& key, const Value& value)
+{
+    if (node->isLeaf){
+        LeafNode* leaf = static_cast<LeafNode*>(node);
+        size_t i = leafSlot(leaf, key);
+        if (i < leaf->count && !(key < leaf->item(i).first)){
+            leaf->item(i).second = value;
+            InsertResult result = { leaf, i, false, NULL, Key() };
+            return result;
+        }
+        return insertIntoLeaf(leaf, i, key, value);
+    }
+
+    InnerNode* inner = static_cast<InnerNode*>(node);
+    size_t c = innerSlot(inner, key);
+    prefetchNode(inner->children[c]);
+    InsertResult result = insertBelow(inner->children[c], key, value);
+    if (result.split != NULL){
+        insertIntoInner(inner, c, result);
+    }
+    return result;
+}
+
+/**
+* Puts a new item into slot i of the leaf, splitting a full leaf in half
+* first.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::InsertResult
+BTree<Key, Value, NodeBytes>::insertIntoLeaf(LeafNode* leaf, size_t i, const Key& key, const Value& value)
+{
+    InsertResult result = { leaf, i, true, NULL, Key() };
+
+    if (leaf->count == LEAF_CAPACITY){
+        LeafNode* right = new LeafNode;
+        right->isLeaf = true;
+        size_t keep = LEAF_CAPACITY / 2;
+        for (size_t j = keep; j < LEAF_CAPACITY; ++j){
+            moveItem(leaf, j, right, j - keep);
+        }
+        right->count = LEAF_CAPACITY - keep;
+        leaf->count = keep;
+        right->next = leaf->next;
+        leaf->next = right;
+
+        if (i > keep){
+            result.leaf = right;
+            result.index = i - keep;
+        }
+        result.split = right;
+    }
+
+    LeafNode* target = result.leaf;
+    for (size_t j = target->count; j > result.index; --j){
+        moveItem(target, j - 1, target, j);
+    }
+    new (&target->slots[result.index]) Item(key, value);
+    ++target->count;
+
+    if (result.split != NULL){
+        result.splitKey = static_cast<LeafNode*>(result.split)->item(0).first;
+    }
+    return result;
+}
+
+/**
+* Adds the separator and new child from a split of child c. A full inner
+* node splits around its middle separator, which moves up in result.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::insertIntoInner(InnerNode* inner, size_t c, InsertResult& result)
+{
+    InnerNode* target = inner;
+    InnerNode* right = NULL;
+    Key promoted = Key();
+
+    if (inner->count == INNER_CAPACITY){
+        size_t mid = INNER_CAPACITY / 2;
+        right = new InnerNode();
+        right->isLeaf = false;
+        right->count = INNER_CAPACITY - mid - 1;
+        for (size_t j = mid + 1; j < INNER_CAPACITY; ++j){
+            right->keys[j - mid - 1] = inner->keys[j];
+        }
+        for (size_t j = mid + 1; j <= INNER_CAPACITY; ++j){
+            right->children[j - mid - 1] = inner->children[j];
+        }
+        promoted = inner->keys[mid];
+        inner->count = mid;
+
+        if (c > mid){
+            target = right;
+            c -= mid + 1;
+        }
+    }
+
+    for (size_t j = target->count; j > c; --j){
+        target->keys[j] = target->keys[j - 1];
+        target->children[j + 1] = target->children[j];
+    }
+    target->keys[c] = result.splitKey;
+    target->children[c + 1] = result.split;
+    ++target->count;
+
+    result.split = right;
+    result.splitKey = promoted;
+}
+
+/**
+* Removes key from the subtree under node. Returns false if it was not
+* there.
+*/
+template<class Key, class Value, size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::removeBelow(NodeBase* node, const Key& key)
+{
+    if (node->isLeaf){
+        LeafNode* leaf = static_cast<LeafNode*>(node);
+        size_t i = leafSlot(leaf, key);
+        if (i == leaf->count || key < leaf->item(i).first){
+            return false;
+        }
+        leaf->item(i).~Item();
+        for (size_t j = i + 1; j < leaf->count; ++j){
+            moveItem(leaf, j, leaf, j - 1);
+        }
+        --leaf->count;
+        return true;
+    }
+
+    InnerNode* inner = static_cast<InnerNode*>(node);
+    size_t c = innerSlot(inner, key);
+    prefetchNode(inner->children[c]);
+    if (!removeBelow(inner->children[c], key)){
+        return false;
+    }
+    if (inner->children[c]->count < minCount(inner->children[c])){
+        fixUnderflow(inner, c);
+    }
+    return true;
+}
+
+/**
+* Fewest entries a non-root node may hold: half a leaf, or as many
+* separators as the smaller half of a split inner node.
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BTree<Key, Value, NodeBytes>::minCount(const NodeBase* node)
+{
+    return node->isLeaf ? LEAF_CAPACITY / 2 : (INNER_CAPACITY - 1) / 2;
+}
+
+/**
+* Refills child c of parent by taking one entry from a sibling that can
+* spare it, or else merges it with a sibling.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::fixUnderflow(InnerNode* parent, size_t c)
+{
+    NodeBase* child = parent->children[c];
+    NodeBase* left = c > 0 ? parent->children[c - 1] : NULL;
+    NodeBase* right = c < parent->count ? parent->children[c + 1] : NULL;
+    if (left != NULL && left->count > minCount(left)){
+        if (child->isLeaf){
+            LeafNode* to = static_cast<LeafNode*>(child);
+            LeafNode* from = static_cast<LeafNode*>(left);
+            for (size_t j = to->count; j > 0; --j){
+                moveItem(to, j - 1, to, j);
+            }
+            moveItem(from, from->count - 1, to, 0);
+            --from->count;
+            ++to->count;
+            parent->keys[c - 1] = to->item(0).first;
+        }
+        else {
+            InnerNode* to = static_cast<InnerNode*>(child);
+            InnerNode* from = static_cast<InnerNode*>(left);
+            to->children[to->count + 1] = to->children[to->count];
+            for (size_t j = to->count; j > 0; --j){
+                to->keys[j] = to->keys[j - 1];
+                to->children[j] = to->children[j - 1];
+            }
+            to->keys[0] = parent->keys[c - 1];
+            to->children[0] = from->children[from->count];
+            parent->keys[c - 1] = from->keys[from->count - 1];
+            --from->count;
+            ++to->count;
+        }
+    }
+    else if (right != NULL && right->count > minCount(right)){
+        if (child->isLeaf){
+            LeafNode* to = static_cast<LeafNode*>(child);
+            LeafNode* from = static_cast<LeafNode*>(right);
+            moveItem(from, 0, to, to->count);
+            for (size_t j = 1; j < from->count; ++j){
+                moveItem(from, j, from, j - 1);
+            }
+            --from->count;
+            ++to->count;
+            parent->keys[c] = from->item(0).first;
+        }
+        else {
+            InnerNode* to = static_cast<InnerNode*>(child);
+            InnerNode* from = static_cast<InnerNode*>(right);
+            to->keys[to->count] = parent->keys[c];
+            to->children[to->count + 1] = from->children[0];
+            parent->keys[c] = from->keys[0];
+            for (size_t j = 1; j < from->count; ++j){
+                from->keys[j - 1] = from->keys[j];
+            }
+            for (size_t j = 1; j <= from->count; ++j){
+                from->children[j - 1] = from->children[j];
+            }
+            --from->count;
+            ++to->count;
+        }
+    }
+    else {
+        mergeChildren(parent, left != NULL ? c - 1 : c);
+    }
+}
+
+/**
+* Merges child c + 1 of parent into child c and drops the separator
+* between them.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::mergeChildren(InnerNode* parent, size_t c)
+{
+    NodeBase* left = parent->children[c];
+    NodeBase* right = parent->children[c + 1];
+
+    if (left->isLeaf){
+        LeafNode* to = static_cast<LeafNode*>(left);
+        LeafNode* from = static_cast<LeafNode*>(right);
+        for (size_t j = 0; j < from->count; ++j){
+            moveItem(from, j, to, to->count + j);
+        }
+        to->count += from->count;
+        to->next = from->next;
+        delete from;
+    }
+    else {
+        InnerNode* to = static_cast<InnerNode*>(left);
+        InnerNode* from = static_cast<InnerNode*>(right);
+        to->keys[to->count] = parent->keys[c];
+        for (size_t j = 0; j < from->count; ++j){
+            to->keys[to->count + 1 + j] = from->keys[j];
+        }
+        for (size_t j = 0; j <= from->count; ++j){
+            to->children[to->count + 1 + j] = from->children[j];
+        }
+        to->count += from->count + 1;
+        delete from;
+    }
+
+    for (size_t j = c + 1; j < parent->count; ++j){
+        parent->keys[j - 1] = parent->keys[j];
+        parent->children[j] = parent->children[j + 1];
+    }
+    --parent->count;
+}
+
+template<class Key, class Value, size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::clearHelp(NodeBase* node)
+{
+    if (node == NULL){
+        return;
+    }
+    if (node->isLeaf){
+        LeafNode* leaf = static_cast<LeafNode*>(node);
+        for (size_t i = 0; i < leaf->count; ++i){
+            leaf->item(i).~Item();
+        }
+        delete leaf;
+        return;
+    }
+    InnerNode* inner = static_cast<InnerNode*>(node);
+    for (size_t i = 0; i <= inner->count; ++i){
+        clearHelp(inner->children[i]);
+    }
+    delete inner;
+}
+
+/*
+-----------------------------------------------
+End implementations for the BTree class.
+-----------------------------------------------
+*/
+
+#endif
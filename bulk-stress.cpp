@@ -0,0 +1,239 @@
+#include <iostream>
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <random>
+#include <cstdlib>
+#include <cstdint>
+#include "avlbst.h"
+
+using namespace std;
+
+/*
+ * Checks the AVLTree bulk operations against std::map: split and join,
+ * unionWith, intersect and difference, and buildFromUnsorted.
+ *
+ *   bulk-stress [keys] [rounds]    (default: 50000 keys, 3 rounds)
+ *
+ * Every round runs each operation on trees of about `keys` items, once
+ * without a pool and once on a ThreadPool. The trees are large enough
+ * that the parallel paths run: subtrees of PARALLEL_HEIGHT levels and
+ * builds of PARALLEL_BUILD items. Both plain and OrderStats trees are
+ * checked. After every operation each tree involved must be a valid AVL
+ * tree whose items and size() match the map, and with OrderStats the
+ * subtree sizes must give the right ranks. Build it with
+ * -fsanitize=thread or -fsanitize=address to also catch races and lost
+ * or doubly linked nodes.
+ */
+
+typedef map<uint64_t, uint64_t> Expected;
+
+static size_t failures = 0;
+
+static void fail(const string& what)
+{
+    if(failures++ < 10) {
+        cerr << "FAIL: " << what << endl;
+    }
+}
+
+template<typename Alloc>
+static bool ranksMatch(const AVLTree<uint64_t, uint64_t, Alloc, false>& tree, const Expected& expected,
+                       mt19937_64& gen)
+{
+    return true;
+}
+
+// Spot checks rank() and select(), which rely on the subtree sizes.
+template<typename Alloc>
+static bool ranksMatch(const AVLTree<uint64_t, uint64_t, Alloc, true>& tree, const Expected& expected,
+                       mt19937_64& gen)
+{
+    if(expected.empty()) {
+        return true;
+    }
+    for(int i = 0; i < 8; i++) {
+        size_t k = gen() % expected.size();
+        Expected::const_iterator want = expected.begin();
+        advance(want, k);
+        if(tree.rank(want->first) != k || tree.select(k)->first != want->first) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Tree>
+static void expectSame(const Tree& tree, const Expected& expected, mt19937_64& gen, const string& what)
+{
+    bool same = tree.size() == expected.size() && tree.isValidAVL();
+    Expected::const_iterator want = expected.begin();
+    for(typename Tree::iterator it = tree.begin(); same && it != tree.end(); ++it, ++want) {
+        same = want != expected.end() && it->first == want->first && it->second == want->second;
+    }
+    if(!same || want != expected.end() || !ranksMatch(tree, expected, gen)) {
+        fail(what);
+    }
+}
+
+// Fills tree and expected with n random keys below range.
+template<typename Tree>
+static void fill(Tree& tree, Expected& expected, size_t n, uint64_t range, mt19937_64& gen)
+{
+    for(size_t i = 0; i < n; i++) {
+        uint64_t key = gen() % range;
+        uint64_t value = gen();
+        tree.insert(make_pair(key, value));
+        expected[key] = value;
+    }
+}
+
+template<typename Tree>
+static void checkBuild(size_t n, ThreadPool* pool, mt19937_64& gen, const string& name)
+{
+    // keys repeat about twice on average; the last copy must win
+    vector<pair<uint64_t, uint64_t> > items(n);
+    Expected expected;
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair(gen() % (n / 2 + 1), gen());
+        expected[items[i].first] = items[i].second;
+    }
+    Tree tree;
+    tree.insert(make_pair(n, 0));   // replaced by the build
+    tree.buildFromUnsorted(items.begin(), items.end(), pool);
+    expectSame(tree, expected, gen, name + " buildFromUnsorted");
+}
+
+template<typename Tree>
+static void checkSplitJoin(size_t n, mt19937_64& gen, const string& name)
+{
+    uint64_t range = 3 * n;
+    uint64_t cuts[] = { 0, gen() % range, gen() % range, range };
+    for(size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+        uint64_t cut = cuts[c];
+        Tree tree, right;
+        Expected expected;
+        fill(tree, expected, n, range, gen);
+        Expected below(expected.begin(), expected.lower_bound(cut));
+        Expected above(expected.lower_bound(cut), expected.end());
+
+        tree.split(cut, right);
+        expectSame(tree, below, gen, name + " split, lower half");
+        expectSame(right, above, gen, name + " split, upper half");
+
+        // join back with cut itself as the middle item
+        right.remove(cut);
+        above.erase(cut);
+        uint64_t value = gen();
+        Tree joined;
+        joined.join(tree, make_pair(cut, value), right);
+        expected = below;
+        expected.insert(above.begin(), above.end());
+        expected[cut] = value;
+        expectSame(joined, expected, gen, name + " join");
+        if(!tree.empty() || !right.empty()) {
+            fail(name + " join left its inputs non-empty");
+        }
+
+        // and in place, appending to the left tree
+        Tree lower, upper;
+        for(Expected::const_iterator it = below.begin(); it != below.end(); ++it) {
+            lower.insert(*it);
+        }
+        for(Expected::const_iterator it = above.begin(); it != above.end(); ++it) {
+            upper.insert(*it);
+        }
+        lower.join(lower, make_pair(cut, value), upper);
+        expectSame(lower, expected, gen, name + " join into the left tree");
+    }
+}
+
+template<typename Tree>
+static void checkSetOps(size_t n, ThreadPool* pool, mt19937_64& gen, const string& name)
+{
+    uint64_t range = 3 * n;
+    size_t sizes[][2] = { { n, n }, { n, n / 100 }, { n / 100, n } };
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        Tree a, b;
+        Expected ea, eb;
+        fill(a, ea, sizes[s][0], range, gen);
+        fill(b, eb, sizes[s][1], range, gen);
+        Expected both, only;
+        for(Expected::const_iterator it = ea.begin(); it != ea.end(); ++it) {
+            (eb.count(it->first) ? both : only).insert(*it);
+        }
+        Expected all = ea;
+        for(Expected::const_iterator it = eb.begin(); it != eb.end(); ++it) {
+            all[it->first] = it->second;
+        }
+
+        Tree u, ub, i, ib, d, db;
+        for(Expected::const_iterator it = ea.begin(); it != ea.end(); ++it) {
+            u.insert(*it);
+            i.insert(*it);
+            d.insert(*it);
+        }
+        for(Expected::const_iterator it = eb.begin(); it != eb.end(); ++it) {
+            ub.insert(*it);
+            ib.insert(*it);
+            db.insert(*it);
+        }
+        u.unionWith(ub, pool);
+        i.intersect(ib, pool);
+        d.difference(db, pool);
+        expectSame(u, all, gen, name + " unionWith");
+        expectSame(i, both, gen, name + " intersect");
+        expectSame(d, only, gen, name + " difference");
+        if(!ub.empty() || !ib.empty() || !db.empty()) {
+            fail(name + " set operation left other non-empty");
+        }
+    }
+
+    Tree a;
+    Expected ea;
+    fill(a, ea, n, range, gen);
+    a.unionWith(a, pool);
+    a.intersect(a, pool);
+    expectSame(a, ea, gen, name + " union and intersection with itself");
+    a.difference(a, pool);
+    expectSame(a, Expected(), gen, name + " difference with itself");
+}
+
+template<typename Tree>
+static void checkAll(size_t n, ThreadPool* pool, mt19937_64& gen, const string& name)
+{
+    checkBuild<Tree>(n, pool, gen, name);
+    if(pool == NULL) {
+        // split and join run sequentially either way
+        checkSplitJoin<Tree>(n, gen, name);
+    }
+    checkSetOps<Tree>(n, pool, gen, name);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000;
+    size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 3;
+    if(n < 200) {
+        n = 200;
+    }
+
+    size_t threads = thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() : 2;
+    ThreadPool pool(threads);
+    mt19937_64 gen(42);
+    for(size_t round = 0; round < rounds; round++) {
+        checkAll<AVLTree<uint64_t, uint64_t> >(n, NULL, gen, "AVL");
+        checkAll<AVLTree<uint64_t, uint64_t> >(n, &pool, gen, "AVL on a pool");
+        checkAll<AVLTree<uint64_t, uint64_t, HeapNodeAllocator, true> >(n, NULL, gen, "AVL+stats");
+        checkAll<AVLTree<uint64_t, uint64_t, HeapNodeAllocator, true> >(n, &pool, gen, "AVL+stats on a pool");
+    }
+
+    cout << rounds << " rounds of bulk operations on " << n << "-key trees, " << threads << " pool threads" << endl;
+    if(failures != 0) {
+        cout << failures << " failures" << endl;
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
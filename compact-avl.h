@@ -0,0 +1,726 @@
+#ifndef COMPACT_AVL_H
+#define COMPACT_AVL_H
+
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include "node-alloc.h"
+
+/**
+* An AVL tree whose nodes hold only the item, two child pointers and a
+* height byte, with no parent pointer.
+*
+* AVLTree walks upward through parent pointers to rebalance after an
+* update and to step its iterators. Here insert and remove recurse down
+* to the change and rebalance each node on the way back up, so the call
+* stack holds the path instead, and iterators keep the path from the root
+* to their node in a fixed array. For 8-byte keys and values a node
+* shrinks from 48 to 40 bytes, so more of the tree stays in cache during
+* lookups.
+*
+* The price is in the iterators: an iterator is a few hundred bytes
+* rather than one pointer, and only stays valid until the tree is next
+* modified. Alloc is the node allocation policy (see node-alloc.h).
+*/
+template <typename Key, typename Value, typename Alloc = HeapNodeAllocator>
+class CompactAVLTree
+{
+protected:
+    struct CompactNode
+    {
+        template<typename... Args>
+        explicit CompactNode(Args&&... args) :
+            item(std::forward<Args>(args)...), left(NULL), right(NULL), height(1)
+        {
+
+        }
+
+        std::pair<const Key, Value> item;
+        CompactNode* left;
+        CompactNode* right;
+        uint8_t height;     // leaves have height 1
+    };
+
+public:
+    // Deepest possible AVL tree holding 2^64 nodes.
+    static const int MAX_HEIGHT = 96;
+
+    CompactAVLTree();
+    ~CompactAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+    bool isValidAVL() const;
+
+    /**
+    * A bidirectional in-order iterator. It holds the path from the root
+    * to its node, so it steps either way without parent pointers in
+    * O(1) amortized. Any insert or remove invalidates it.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+        iterator(const iterator& other);
+        iterator& operator=(const iterator& other);
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Alloc>;
+        explicit iterator(const CompactAVLTree<Key, Value, Alloc>* tree);
+        void pushSpine(CompactNode* node, bool leftward);
+
+        // path_[0] is the root and path_[depth_ - 1] the current node;
+        // depth_ is 0 at the end.
+        CompactNode* path_[MAX_HEIGHT];
+        int depth_;
+        const CompactAVLTree<Key, Value, Alloc>* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    CompactNode* findNode(const Key& key) const;
+    CompactNode* createNode(const Key& key, const Value& value);
+    void destroyNode(CompactNode* node);
+    void clearHelp(CompactNode* node);
+    static int height(const CompactNode* node);
+    static void updateHeight(CompactNode* node);
+    static CompactNode* rotateLeft(CompactNode* node);
+    static CompactNode* rotateRight(CompactNode* node);
+    static CompactNode* rebalance(CompactNode* node);
+    static CompactNode* rebalance(CompactNode* node, bool& changed);
+    CompactNode* insertHelp(CompactNode* node, const Key& key, const Value& value, bool& changed);
+    CompactNode* removeHelp(CompactNode* node, const Key& key, bool& changed);
+    static CompactNode* removeMin(CompactNode* node, CompactNode*& min, bool& changed);
+    static int checkHelp(const CompactNode* node, const Key* lo, const Key* hi);
+
+protected:
+    CompactNode* root_;
+    Alloc alloc_;
+    size_t size_;
+
+private:
+    CompactAVLTree(const CompactAVLTree&);
+    CompactAVLTree& operator=(const CompactAVLTree&);
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the CompactAVLTree::iterator class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+CompactAVLTree<Key, Value, Alloc>::iterator::iterator() :
+    depth_(0),
+    tree_(NULL)
+{
+
+}
+
+/**
+* Copies only the part of the path in use, not the whole array.
+*/
+template<class Key, class Value, class Alloc>
+CompactAVLTree<Key, Value, Alloc>::iterator::iterator(const iterator& other) :
+    depth_(other.depth_),
+    tree_(other.tree_)
+{
+    std::copy(other.path_, other.path_ + depth_, path_);
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator&
+CompactAVLTree<Key, Value, Alloc>::iterator::operator=(const iterator& other)
+{
+    depth_ = other.depth_;
+    tree_ = other.tree_;
+    std::copy(other.path_, other.path_ + depth_, path_);
+    return *this;
+}
+
+/**
+* An end iterator of tree.
+*/
+template<class Key, class Value, class Alloc>
+CompactAVLTree<Key, Value, Alloc>::iterator::iterator(const CompactAVLTree<Key, Value, Alloc>* tree) :
+    depth_(0),
+    tree_(tree)
+{
+
+}
+
+/**
+* Pushes node and its chain of left (or right) descendants: the path to
+* the smallest (or largest) item below node.
+*/
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::iterator::pushSpine(CompactNode* node, bool leftward)
+{
+    for (; node != NULL; node = leftward ? node->left : node->right){
+        path_[depth_++] = node;
+    }
+}
+
+template<class Key, class Value, class Alloc>
+std::pair<const Key,Value> &
+CompactAVLTree<Key, Value, Alloc>::iterator::operator*() const
+{
+    return path_[depth_ - 1]->item;
+}
+
+template<class Key, class Value, class Alloc>
+std::pair<const Key,Value> *
+CompactAVLTree<Key, Value, Alloc>::iterator::operator->() const
+{
+    return &(path_[depth_ - 1]->item);
+}
+
+template<class Key, class Value, class Alloc>
+bool CompactAVLTree<Key, Value, Alloc>::iterator::operator==(const iterator& rhs) const
+{
+    return depth_ == rhs.depth_ && (depth_ == 0 || path_[depth_ - 1] == rhs.path_[depth_ - 1]);
+}
+
+template<class Key, class Value, class Alloc>
+bool CompactAVLTree<Key, Value, Alloc>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Descends to the smallest item of the right subtree if there is one;
+* otherwise climbs until it arrives at an ancestor from the left.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator&
+CompactAVLTree<Key, Value, Alloc>::iterator::operator++()
+{
+    CompactNode* node = path_[depth_ - 1];
+    if (node->right != NULL){
+        pushSpine(node->right, true);
+        return *this;
+    }
+    do {
+        node = path_[--depth_];
+    } while (depth_ > 0 && path_[depth_ - 1]->right == node);
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator
+CompactAVLTree<Key, Value, Alloc>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/**
+* The mirror image of operator++; from end() to the largest item.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator&
+CompactAVLTree<Key, Value, Alloc>::iterator::operator--()
+{
+    if (depth_ == 0){
+        pushSpine(tree_->root_, false);
+        return *this;
+    }
+    CompactNode* node = path_[depth_ - 1];
+    if (node->left != NULL){
+        pushSpine(node->left, false);
+        return *this;
+    }
+    do {
+        node = path_[--depth_];
+    } while (depth_ > 0 && path_[depth_ - 1]->left == node);
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator
+CompactAVLTree<Key, Value, Alloc>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --*this;
+    return old;
+}
+
+/*
+-----------------------------------------------
+End implementations for the CompactAVLTree::iterator class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the CompactAVLTree class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+CompactAVLTree<Key, Value, Alloc>::CompactAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+CompactAVLTree<Key, Value, Alloc>::~CompactAVLTree()
+{
+    clear();
+}
+
+template<class Key, class Value, class Alloc>
+bool CompactAVLTree<Key, Value, Alloc>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value, class Alloc>
+size_t CompactAVLTree<Key, Value, Alloc>::size() const
+{
+    return size_;
+}
+
+/**
+* Height in nodes: 0 when empty.
+*/
+template<class Key, class Value, class Alloc>
+int CompactAVLTree<Key, Value, Alloc>::height() const
+{
+    return height(root_);
+}
+
+/**
+* Checks ordering, stored heights and AVL balance.
+*/
+template<class Key, class Value, class Alloc>
+bool CompactAVLTree<Key, Value, Alloc>::isValidAVL() const
+{
+    return checkHelp(root_, NULL, NULL) >= 0;
+}
+
+/**
+* Removes every item. Like BinarySearchTree::clear, a pool allocator of
+* trivially destructible items skips the per-node walk.
+*/
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::clear()
+{
+    if (!Alloc::bulkRelease || !std::is_trivially_destructible<Key>::value
+            || !std::is_trivially_destructible<Value>::value){
+        clearHelp(root_);
+    }
+    if (Alloc::bulkRelease){
+        alloc_.release();
+    }
+    root_ = NULL;
+    size_ = 0;
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator
+CompactAVLTree<Key, Value, Alloc>::begin() const
+{
+    iterator it(this);
+    it.pushSpine(root_, true);
+    return it;
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator
+CompactAVLTree<Key, Value, Alloc>::end() const
+{
+    return iterator(this);
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::reverse_iterator
+CompactAVLTree<Key, Value, Alloc>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::reverse_iterator
+CompactAVLTree<Key, Value, Alloc>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns an iterator to the key's item, or end() if it is not present.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator
+CompactAVLTree<Key, Value, Alloc>::find(const Key& key) const
+{
+    iterator it(this);
+    for (CompactNode* node = root_; node != NULL; ){
+        it.path_[it.depth_++] = node;
+        if (key == node->item.first){
+            return it;
+        }
+        node = key < node->item.first ? node->left : node->right;
+    }
+    it.depth_ = 0;
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none. The search path passes through that item,
+* so the path up to it is the iterator's.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::iterator
+CompactAVLTree<Key, Value, Alloc>::lowerBound(const Key& key) const
+{
+    iterator it(this);
+    int found = 0;
+    for (CompactNode* node = root_; node != NULL; ){
+        it.path_[it.depth_++] = node;
+        if (node->item.first < key){
+            node = node->right;
+        }
+        else {
+            found = it.depth_;
+            node = node->left;
+        }
+    }
+    it.depth_ = found;
+    return it;
+}
+
+/**
+* Throws std::out_of_range if the key is not present.
+*/
+template<class Key, class Value, class Alloc>
+Value& CompactAVLTree<Key, Value, Alloc>::operator[](const Key& key)
+{
+    CompactNode* node = findNode(key);
+    if (node == NULL) throw std::out_of_range("Invalid key");
+    return node->item.second;
+}
+
+template<class Key, class Value, class Alloc>
+Value const & CompactAVLTree<Key, Value, Alloc>::operator[](const Key& key) const
+{
+    CompactNode* node = findNode(key);
+    if (node == NULL) throw std::out_of_range("Invalid key");
+    return node->item.second;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool changed = false;
+    root_ = insertHelp(root_, keyValuePair.first, keyValuePair.second, changed);
+}
+
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::remove(const Key& key)
+{
+    bool changed = false;
+    root_ = removeHelp(root_, key, changed);
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::findNode(const Key& key) const
+{
+    // Testing for the key first leaves a two-way choice of child, which
+    // compiles to a conditional move instead of a mispredicted branch.
+    CompactNode* node = root_;
+    while (node != NULL && !(key == node->item.first)){
+        node = key < node->item.first ? node->left : node->right;
+    }
+    return node;
+}
+
+/**
+* Constructs a node in storage from the allocator, handing the storage
+* back if the item's constructor throws.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::createNode(const Key& key, const Value& value)
+{
+    void* storage = alloc_.allocate(sizeof(CompactNode));
+    try {
+        return new (storage) CompactNode(key, value);
+    }
+    catch (...) {
+        alloc_.deallocate(storage);
+        throw;
+    }
+}
+
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::destroyNode(CompactNode* node)
+{
+    node->~CompactNode();
+    alloc_.deallocate(node);
+}
+
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::clearHelp(CompactNode* node)
+{
+    if (node == NULL){
+        return;
+    }
+    clearHelp(node->left);
+    clearHelp(node->right);
+    destroyNode(node);
+}
+
+template<class Key, class Value, class Alloc>
+int CompactAVLTree<Key, Value, Alloc>::height(const CompactNode* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+template<class Key, class Value, class Alloc>
+void CompactAVLTree<Key, Value, Alloc>::updateHeight(CompactNode* node)
+{
+    int lh = height(node->left);
+    int rh = height(node->right);
+    node->height = 1 + (lh > rh ? lh : rh);
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::rotateLeft(CompactNode* node)
+{
+    CompactNode* child = node->right;
+    node->right = child->left;
+    child->left = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::rotateRight(CompactNode* node)
+{
+    CompactNode* child = node->left;
+    node->left = child->right;
+    child->right = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+/**
+* Restores the AVL balance of a node whose subtrees differ in height by
+* at most two, and returns the subtree's new root.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::rebalance(CompactNode* node)
+{
+    updateHeight(node);
+    int balance = height(node->right) - height(node->left);
+    if (balance < -1){
+        if (height(node->left->right) > height(node->left->left)){
+            node->left = rotateLeft(node->left);
+        }
+        return rotateRight(node);
+    }
+    if (balance > 1){
+        if (height(node->right->left) > height(node->right->right)){
+            node->right = rotateRight(node->right);
+        }
+        return rotateLeft(node);
+    }
+    return node;
+}
+
+/**
+* Rebalances node and sets changed if its subtree got a new root or a
+* new height, i.e. if the parent has anything left to fix.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::rebalance(CompactNode* node, bool& changed)
+{
+    int oldHeight = node->height;
+    CompactNode* root = rebalance(node);
+    changed = root != node || root->height != oldHeight;
+    return root;
+}
+
+/**
+* Inserts below node and rebalances each node on the way back up; the
+* recursion stands in for the parent pointers. Once a subtree comes back
+* unchanged the nodes above it are left alone, which spares the reads of
+* their other children.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::insertHelp(CompactNode* node, const Key& key, const Value& value, bool& changed)
+{
+    if (node == NULL){
+        CompactNode* created = createNode(key, value);
+        ++size_;
+        changed = true;
+        return created;
+    }
+    if (key == node->item.first){
+        node->item.second = value;
+        return node;
+    }
+    if (key < node->item.first){
+        CompactNode* left = insertHelp(node->left, key, value, changed);
+        if (!changed){
+            return node;
+        }
+        node->left = left;
+    }
+    else {
+        CompactNode* right = insertHelp(node->right, key, value, changed);
+        if (!changed){
+            return node;
+        }
+        node->right = right;
+    }
+    return rebalance(node, changed);
+}
+
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::removeHelp(CompactNode* node, const Key& key, bool& changed)
+{
+    if (node == NULL){
+        return NULL;
+    }
+    if (!(key == node->item.first)){
+        if (key < node->item.first){
+            CompactNode* left = removeHelp(node->left, key, changed);
+            if (!changed){
+                return node;
+            }
+            node->left = left;
+        }
+        else {
+            CompactNode* right = removeHelp(node->right, key, changed);
+            if (!changed){
+                return node;
+            }
+            node->right = right;
+        }
+        return rebalance(node, changed);
+    }
+    --size_;
+    changed = true;
+    CompactNode* left = node->left;
+    CompactNode* right = node->right;
+    destroyNode(node);
+    if (left == NULL){
+        return right;
+    }
+    if (right == NULL){
+        return left;
+    }
+    // replace the node with its successor
+    CompactNode* successor = NULL;
+    bool rightChanged = false;
+    right = removeMin(right, successor, rightChanged);
+    successor->left = left;
+    successor->right = right;
+    return rebalance(successor);
+}
+
+/**
+* Unlinks the smallest node below node into min and returns the rest.
+*/
+template<class Key, class Value, class Alloc>
+typename CompactAVLTree<Key, Value, Alloc>::CompactNode*
+CompactAVLTree<Key, Value, Alloc>::removeMin(CompactNode* node, CompactNode*& min, bool& changed)
+{
+    if (node->left == NULL){
+        min = node;
+        changed = true;
+        return node->right;
+    }
+    CompactNode* left = removeMin(node->left, min, changed);
+    if (!changed){
+        return node;
+    }
+    node->left = left;
+    return rebalance(node, changed);
+}
+
+/**
+* Returns the height of node's subtree, or -1 if it is out of order, out
+* of balance or has a wrong stored height.
+*/
+template<class Key, class Value, class Alloc>
+int CompactAVLTree<Key, Value, Alloc>::checkHelp(const CompactNode* node, const Key* lo, const Key* hi)
+{
+    if (node == NULL){
+        return 0;
+    }
+    const Key& key = node->item.first;
+    if ((lo != NULL && !(*lo < key)) || (hi != NULL && !(key < *hi))){
+        return -1;
+    }
+    int lh = checkHelp(node->left, lo, &key);
+    int rh = checkHelp(node->right, &key, hi);
+    if (lh < 0 || rh < 0 || lh - rh > 1 || rh - lh > 1){
+        return -1;
+    }
+    int h = 1 + (lh > rh ? lh : rh);
+    return h == node->height ? h : -1;
+}
+
+/*
+-----------------------------------------------
+End implementations for the CompactAVLTree class.
+-----------------------------------------------
+*/
+
+#endif
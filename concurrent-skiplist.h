@@ -0,0 +1,447 @@
+#ifndef CONCURRENT_SKIPLIST_H
+#define CONCURRENT_SKIPLIST_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include "epoch-reclaim.h"
+
+/**
+* An ordered map that any number of threads may insert into, remove from
+* and search at the same time: a lazy skip list with one lock per node.
+*
+* Searches never lock on the way down. An update searches the same way,
+* then locks only the predecessors it will relink and checks that they
+* are still unmarked and still point where the search saw them; if not,
+* it retries. A removal first marks its node (the logical removal) and
+* then unlinks it level by level under the predecessors' locks. Locks are
+* always taken from higher keys to lower ones, so updates cannot
+* deadlock, and updates to different parts of the list proceed in
+* parallel.
+*
+* A node is in the map once it is linked at every level and until it is
+* marked. Values can be overwritten in place, so they are read and
+* written under the node's lock; keys never change and are read freely.
+* Unlinked nodes are freed through an EpochReclaimer once no search can
+* still be standing on them.
+*
+* Unlike the other maps there are no iterators, which could not stay
+* valid under concurrent removal; forEach visits a weakly consistent
+* sequence of copies instead.
+*/
+template <typename Key, typename Value>
+class ConcurrentSkipList
+{
+public:
+    // A node has a 1-in-2^(k-1) chance of reaching level k.
+    static const int MAX_LEVEL = 32;
+
+    ConcurrentSkipList();
+    ~ConcurrentSkipList();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    template<typename Visit>
+    void forEach(Visit visit) const;
+    bool empty() const;
+    size_t size() const;
+    bool isValidSkipList() const;
+
+protected:
+    typedef std::pair<const Key, Value> Item;
+
+    /**
+    * A node header followed in memory by its `levels` next pointers. The
+    * head sentinel has MAX_LEVEL of them and no item.
+    */
+    struct SkipNode
+    {
+        explicit SkipNode(int levels) :
+            marked(false), fullyLinked(false), levels(levels)
+        {
+
+        }
+
+        Item& item() { return *reinterpret_cast<Item*>(&storage); }
+        const Item& item() const { return *reinterpret_cast<const Item*>(&storage); }
+        std::atomic<SkipNode*>* next() { return reinterpret_cast<std::atomic<SkipNode*>*>(this + 1); }
+
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type storage;
+        std::mutex lock;                  // guards the value and the next pointers
+        std::atomic<bool> marked;         // logically removed
+        std::atomic<bool> fullyLinked;    // linked at every level
+        int levels;
+    };
+
+    static SkipNode* allocateNode(int levels);
+    static void freeNode(SkipNode* node);
+    static SkipNode* createNode(const Key& key, const Value& value, int levels);
+    static void destroyNode(void* node);
+    static int randomLevels();
+    int findPosition(const Key& key, SkipNode** preds, SkipNode** succs) const;
+    static void unlockAll(SkipNode** locked, int count);
+
+protected:
+    SkipNode* head_;
+    std::atomic<size_t> size_;
+    EpochReclaimer reclaimer_;
+
+private:
+    ConcurrentSkipList(const ConcurrentSkipList&);
+    ConcurrentSkipList& operator=(const ConcurrentSkipList&);
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the ConcurrentSkipList class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+ConcurrentSkipList<Key, Value>::ConcurrentSkipList() :
+    head_(allocateNode(MAX_LEVEL)),
+    size_(0)
+{
+    head_->fullyLinked.store(true);
+}
+
+/**
+* No other thread may still be using the list.
+*/
+template<class Key, class Value>
+ConcurrentSkipList<Key, Value>::~ConcurrentSkipList()
+{
+    SkipNode* node = head_->next()[0].load();
+    while (node != NULL){
+        SkipNode* next = node->next()[0].load();
+        destroyNode(node);
+        node = next;
+    }
+    freeNode(head_);
+}
+
+template<class Key, class Value>
+typename ConcurrentSkipList<Key, Value>::SkipNode*
+ConcurrentSkipList<Key, Value>::allocateNode(int levels)
+{
+    void* memory = ::operator new(sizeof(SkipNode) + levels * sizeof(std::atomic<SkipNode*>));
+    SkipNode* node = new (memory) SkipNode(levels);
+    for (int level = 0; level < levels; ++level){
+        new (&node->next()[level]) std::atomic<SkipNode*>(NULL);
+    }
+    return node;
+}
+
+template<class Key, class Value>
+void ConcurrentSkipList<Key, Value>::freeNode(SkipNode* node)
+{
+    node->~SkipNode();
+    ::operator delete(node);
+}
+
+template<class Key, class Value>
+typename ConcurrentSkipList<Key, Value>::SkipNode*
+ConcurrentSkipList<Key, Value>::createNode(const Key& key, const Value& value, int levels)
+{
+    SkipNode* node = allocateNode(levels);
+    new (&node->storage) Item(key, value);
+    return node;
+}
+
+template<class Key, class Value>
+void ConcurrentSkipList<Key, Value>::destroyNode(void* node)
+{
+    SkipNode* skipNode = static_cast<SkipNode*>(node);
+    skipNode->item().~Item();
+    freeNode(skipNode);
+}
+
+/**
+* Draws a geometric level count from a per-thread xorshift generator.
+*/
+template<class Key, class Value>
+int ConcurrentSkipList<Key, Value>::randomLevels()
+{
+    static thread_local uint64_t state =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t bits = state | (uint64_t(1) << (MAX_LEVEL - 1));
+#if defined(__GNUC__)
+    return 1 + __builtin_ctzll(bits);
+#else
+    int levels = 1;
+    while ((bits & 1) == 0){
+        bits >>= 1;
+        ++levels;
+    }
+    return levels;
+#endif
+}
+
+/**
+* Fills preds and succs with the last node before key and the first node
+* at or after it on every level. Returns the highest level on which key
+* itself was found, or -1. The caller must have pinned the reclaimer.
+*/
+template<class Key, class Value>
+int ConcurrentSkipList<Key, Value>::findPosition(const Key& key, SkipNode** preds, SkipNode** succs) const
+{
+    int found = -1;
+    SkipNode* pred = head_;
+    for (int level = MAX_LEVEL - 1; level >= 0; --level){
+        SkipNode* curr = pred->next()[level].load(std::memory_order_acquire);
+        while (curr != NULL && curr->item().first < key){
+            pred = curr;
+            curr = pred->next()[level].load(std::memory_order_acquire);
+        }
+        if (found == -1 && curr != NULL && !(key < curr->item().first)){
+            found = level;
+        }
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return found;
+}
+
+template<class Key, class Value>
+void ConcurrentSkipList<Key, Value>::unlockAll(SkipNode** locked, int count)
+{
+    for (int i = 0; i < count; ++i){
+        locked[i]->lock.unlock();
+    }
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value>
+void ConcurrentSkipList<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    int levels = randomLevels();
+    SkipNode* preds[MAX_LEVEL];
+    SkipNode* succs[MAX_LEVEL];
+    EpochReclaimer::Guard pinned(reclaimer_);
+    while (true){
+        int found = findPosition(key, preds, succs);
+        if (found != -1){
+            SkipNode* node = succs[found];
+            if (!node->marked.load()){
+                // wait for a concurrent insert of the key to finish linking
+                while (!node->fullyLinked.load()){
+                    std::this_thread::yield();
+                }
+                std::lock_guard<std::mutex> lock(node->lock);
+                if (!node->marked.load()){
+                    node->item().second = keyValuePair.second;
+                    return;
+                }
+            }
+            // being removed; retry once it is unlinked
+            continue;
+        }
+
+        // Lock each distinct predecessor, bottom level first, and check
+        // that nothing changed between it and its successor since the
+        // search.
+        SkipNode* locked[MAX_LEVEL];
+        int lockCount = 0;
+        bool valid = true;
+        for (int level = 0; valid && level < levels; ++level){
+            SkipNode* pred = preds[level];
+            SkipNode* succ = succs[level];
+            if (lockCount == 0 || locked[lockCount - 1] != pred){
+                pred->lock.lock();
+                locked[lockCount++] = pred;
+            }
+            valid = !pred->marked.load() && (succ == NULL || !succ->marked.load()) &&
+                pred->next()[level].load() == succ;
+        }
+        if (valid){
+            SkipNode* node = createNode(key, keyValuePair.second, levels);
+            for (int level = 0; level < levels; ++level){
+                node->next()[level].store(succs[level], std::memory_order_relaxed);
+            }
+            for (int level = 0; level < levels; ++level){
+                preds[level]->next()[level].store(node, std::memory_order_release);
+            }
+            node->fullyLinked.store(true);
+            size_.fetch_add(1);
+        }
+        unlockAll(locked, lockCount);
+        if (valid){
+            return;
+        }
+    }
+}
+
+/**
+* Removes the key if present. The node is marked under its own lock, which
+* is held until it has been unlinked from every level.
+*/
+template<class Key, class Value>
+void ConcurrentSkipList<Key, Value>::remove(const Key& key)
+{
+    SkipNode* preds[MAX_LEVEL];
+    SkipNode* succs[MAX_LEVEL];
+    SkipNode* victim = NULL;
+    EpochReclaimer::Guard pinned(reclaimer_);
+    while (true){
+        int found = findPosition(key, preds, succs);
+        if (victim == NULL){
+            if (found == -1){
+                return;
+            }
+            // A node still being linked, or found below its top level, is
+            // not in the map yet.
+            SkipNode* node = succs[found];
+            if (!node->fullyLinked.load() || node->levels - 1 != found || node->marked.load()){
+                return;
+            }
+            node->lock.lock();
+            if (node->marked.load()){
+                node->lock.unlock();
+                return;
+            }
+            node->marked.store(true);
+            victim = node;
+        }
+
+        SkipNode* locked[MAX_LEVEL];
+        int lockCount = 0;
+        bool valid = true;
+        for (int level = 0; valid && level < victim->levels; ++level){
+            SkipNode* pred = preds[level];
+            if (lockCount == 0 || locked[lockCount - 1] != pred){
+                pred->lock.lock();
+                locked[lockCount++] = pred;
+            }
+            valid = !pred->marked.load() && pred->next()[level].load() == victim;
+        }
+        if (valid){
+            for (int level = victim->levels - 1; level >= 0; --level){
+                preds[level]->next()[level].store(victim->next()[level].load(), std::memory_order_release);
+            }
+            victim->lock.unlock();
+            size_.fetch_sub(1);
+        }
+        unlockAll(locked, lockCount);
+        if (valid){
+            reclaimer_.retire(victim, &destroyNode);
+            return;
+        }
+    }
+}
+
+/**
+* Copies the key's current value into value. Returns false if the key is
+* not present. Only the node holding the key is locked, to read the value.
+*/
+template<class Key, class Value>
+bool ConcurrentSkipList<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochReclaimer::Guard pinned(reclaimer_);
+    SkipNode* pred = head_;
+    SkipNode* node = NULL;
+    for (int level = MAX_LEVEL - 1; level >= 0 && node == NULL; --level){
+        SkipNode* curr = pred->next()[level].load(std::memory_order_acquire);
+        while (curr != NULL && curr->item().first < key){
+            pred = curr;
+            curr = pred->next()[level].load(std::memory_order_acquire);
+        }
+        if (curr != NULL && !(key < curr->item().first)){
+            node = curr;
+        }
+    }
+    if (node == NULL || !node->fullyLinked.load() || node->marked.load()){
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(node->lock);
+    if (node->marked.load()){
+        return false;
+    }
+    value = node->item().second;
+    return true;
+}
+
+/**
+* Calls visit with a copy of each item in ascending key order. Items
+* inserted or removed during the walk may or may not be visited.
+*/
+template<class Key, class Value>
+template<typename Visit>
+void ConcurrentSkipList<Key, Value>::forEach(Visit visit) const
+{
+    EpochReclaimer::Guard pinned(reclaimer_);
+    for (SkipNode* node = head_->next()[0].load(std::memory_order_acquire); node != NULL;
+         node = node->next()[0].load(std::memory_order_acquire)){
+        if (!node->fullyLinked.load() || node->marked.load()){
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(node->lock);
+        if (node->marked.load()){
+            continue;
+        }
+        Item copy(node->item());
+        lock.unlock();
+        visit(copy);
+    }
+}
+
+template<class Key, class Value>
+bool ConcurrentSkipList<Key, Value>::empty() const
+{
+    return size_.load() == 0;
+}
+
+template<class Key, class Value>
+size_t ConcurrentSkipList<Key, Value>::size() const
+{
+    return size_.load();
+}
+
+/**
+* Checks that every level is in strictly ascending key order, holds only
+* nodes tall enough for it and no removed nodes, and that the bottom level
+* holds size() nodes. Meaningful only while no update is in progress.
+*/
+template<class Key, class Value>
+bool ConcurrentSkipList<Key, Value>::isValidSkipList() const
+{
+    EpochReclaimer::Guard pinned(reclaimer_);
+    for (int level = 0; level < MAX_LEVEL; ++level){
+        size_t count = 0;
+        const SkipNode* previous = NULL;
+        for (SkipNode* node = head_->next()[level].load(); node != NULL; node = node->next()[level].load()){
+            if (node->levels <= level || node->marked.load() || !node->fullyLinked.load()){
+                return false;
+            }
+            if (previous != NULL && !(previous->item().first < node->item().first)){
+                return false;
+            }
+            previous = node;
+            ++count;
+        }
+        if (level == 0 && count != size_.load()){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+-----------------------------------------------
+End implementations for the ConcurrentSkipList class.
+-----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef EPOCH_RECLAIM_H
+#define EPOCH_RECLAIM_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+
+/**
+* Epoch-based reclamation for structures whose readers do not lock.
+*
+* A reader pins the reclaimer for as long as it holds pointers into the
+* structure, which announces the epoch it started in. A writer that has
+* unlinked objects, so that no new reader can reach them, retires them:
+* the global epoch advances and the objects are freed only once every
+* reader still pinned started at or after that new epoch, i.e. after the
+* objects became unreachable.
+*
+* pin and unpin are lock-free. retire may be called from several threads
+* at once; the retired lists are guarded by a mutex.
+*/
+class EpochReclaimer
+{
+public:
+    static const size_t MAX_READERS = 128;
+
+    EpochReclaimer();
+    ~EpochReclaimer();
+
+    size_t pin() const;
+    void unpin(size_t slot) const;
+
+    template<typename T>
+    void retire(T* object);
+    template<typename T>
+    void retire(std::vector<T*>& objects);
+    void retire(void* object, void (*destroy)(void*));
+
+    /**
+    * Pins the reclaimer for the lifetime of the guard.
+    */
+    class Guard
+    {
+    public:
+        explicit Guard(const EpochReclaimer& reclaimer) :
+            reclaimer_(reclaimer), slot_(reclaimer.pin())
+        {
+
+        }
+        ~Guard()
+        {
+            reclaimer_.unpin(slot_);
+        }
+
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+
+        const EpochReclaimer& reclaimer_;
+        size_t slot_;
+    };
+
+protected:
+    // Attempt to free old batches after this many retirements.
+    static const size_t RECLAIM_INTERVAL = 32;
+
+    // An active reader's epoch; padded so readers do not share lines.
+    struct ReaderSlot
+    {
+        std::atomic<uint64_t> epoch;   // 0 when the slot is free
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    struct Retired
+    {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    // Objects retired together, freeable once every reader is in an epoch
+    // at or after `epoch`.
+    struct RetiredBatch
+    {
+        uint64_t epoch;
+        std::vector<Retired> objects;
+    };
+
+    template<typename T>
+    static void deleteObject(void* object);
+    void retireBatch(std::vector<Retired>& objects);
+    void reclaim();
+    static void destroyBatch(RetiredBatch& batch);
+
+    std::atomic<uint64_t> epoch_;
+    mutable ReaderSlot readers_[MAX_READERS];
+    std::mutex limboMutex_;
+    std::deque<RetiredBatch> limbo_;
+    size_t sinceReclaim_;
+
+private:
+    EpochReclaimer(const EpochReclaimer&);
+    EpochReclaimer& operator=(const EpochReclaimer&);
+};
+
+inline EpochReclaimer::EpochReclaimer() :
+    epoch_(1),
+    sinceReclaim_(0)
+{
+    for (size_t i = 0; i < MAX_READERS; ++i){
+        readers_[i].epoch.store(0);
+    }
+}
+
+/**
+* Frees everything still retired. No reader may be pinned.
+*/
+inline EpochReclaimer::~EpochReclaimer()
+{
+    for (size_t i = 0; i < limbo_.size(); ++i){
+        destroyBatch(limbo_[i]);
+    }
+}
+
+/**
+* Claims a reader slot and announces the current epoch in it. Slots are
+* probed from a per-thread starting point so readers rarely collide.
+*/
+inline size_t EpochReclaimer::pin() const
+{
+    static thread_local size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (size_t attempt = 0; ; ++attempt){
+        size_t slot = (hint + attempt) % MAX_READERS;
+        uint64_t expected = 0;
+        if (readers_[slot].epoch.load(std::memory_order_relaxed) == 0 &&
+            readers_[slot].epoch.compare_exchange_strong(expected, epoch_.load())){
+            hint = slot;
+            return slot;
+        }
+        if (attempt % MAX_READERS == MAX_READERS - 1){
+            std::this_thread::yield();
+        }
+    }
+}
+
+inline void EpochReclaimer::unpin(size_t slot) const
+{
+    readers_[slot].epoch.store(0, std::memory_order_release);
+}
+
+/**
+* Retires one object allocated with new.
+*/
+template<typename T>
+void EpochReclaimer::retire(T* object)
+{
+    retire(object, &deleteObject<T>);
+}
+
+/**
+* Retires every object in the vector, allocated with new, and empties it.
+*/
+template<typename T>
+void EpochReclaimer::retire(std::vector<T*>& objects)
+{
+    if (objects.empty()){
+        return;
+    }
+    std::vector<Retired> batch(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i){
+        batch[i].object = objects[i];
+        batch[i].destroy = &deleteObject<T>;
+    }
+    objects.clear();
+    retireBatch(batch);
+}
+
+/**
+* Retires an object that destroy knows how to free.
+*/
+inline void EpochReclaimer::retire(void* object, void (*destroy)(void*))
+{
+    std::vector<Retired> batch(1);
+    batch[0].object = object;
+    batch[0].destroy = destroy;
+    retireBatch(batch);
+}
+
+template<typename T>
+void EpochReclaimer::deleteObject(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+/**
+* The epoch advances after the objects were unlinked, so a reader that
+* announces the new epoch can no longer reach them.
+*/
+inline void EpochReclaimer::retireBatch(std::vector<Retired>& objects)
+{
+    std::lock_guard<std::mutex> lock(limboMutex_);
+    limbo_.push_back(RetiredBatch());
+    limbo_.back().epoch = epoch_.fetch_add(1) + 1;
+    limbo_.back().objects.swap(objects);
+    if (++sinceReclaim_ >= RECLAIM_INTERVAL){
+        sinceReclaim_ = 0;
+        reclaim();
+    }
+}
+
+/**
+* Frees the batches that no pinned reader can still see. Called with
+* limboMutex_ held.
+*/
+inline void EpochReclaimer::reclaim()
+{
+    uint64_t oldest = epoch_.load();
+    for (size_t i = 0; i < MAX_READERS; ++i){
+        uint64_t epoch = readers_[i].epoch.load();
+        if (epoch != 0 && epoch < oldest){
+            oldest = epoch;
+        }
+    }
+    while (!limbo_.empty() && limbo_.front().epoch <= oldest){
+        destroyBatch(limbo_.front());
+        limbo_.pop_front();
+    }
+}
+
+inline void EpochReclaimer::destroyBatch(RetiredBatch& batch)
+{
+    for (size_t i = 0; i < batch.objects.size(); ++i){
+        batch.objects[i].destroy(batch.objects[i].object);
+    }
+}
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef FROZEN_INDEX_H
+#define FROZEN_INDEX_H
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+
+/**
+* An immutable, pointer-free search index produced by
+* BinarySearchTree::freeze().
+*
+* The items are stored in Eytzinger (BFS) order: the root of an implicit
+* complete binary tree sits at position 1 and the children of position k
+* at 2k and 2k+1. A lookup is then a branch-free descent over a dense
+* array of keys with no pointers to chase. Because the children of k lie
+* next to each other, the 2^d descendants of k at depth d are contiguous,
+* so a single prefetch of the cache line d = log2(64 / sizeof(Key)) levels
+* down covers all of them. The current level is compared while that line
+* loads. That is four levels for 4-byte keys and three for 8-byte keys.
+*
+* Iteration follows the implicit tree in order, so begin()..end() visits
+* the items in ascending key order just like the tree it was frozen
+* from. The keys are kept twice: densely for searching, and beside their
+* values for access through iterators.
+*/
+template <typename Key, typename Value>
+class FrozenIndex
+{
+public:
+    FrozenIndex();
+    template<typename ForwardIt>
+    FrozenIndex(ForwardIt first, ForwardIt last, size_t n);
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+    * Walks the frozen items in ascending key order. Items are read-only.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class FrozenIndex<Key, Value>;
+        iterator(const FrozenIndex<Key, Value>* index, size_t pos);
+        const FrozenIndex<Key, Value>* index_;
+        size_t pos_;    // Eytzinger position, 0 at the end
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+protected:
+    size_t lowerBoundPos(const Key& key) const;
+    size_t successor(size_t pos) const;
+
+    // Keys per cache line. The descent prefetches position KEYS_PER_LINE * k,
+    // i.e. log2(KEYS_PER_LINE) levels below k (16 * k for 4-byte keys).
+    static const size_t KEYS_PER_LINE = sizeof(Key) >= 64 ? 1 : 64 / sizeof(Key);
+
+    std::vector<Key> keys_;                         // keys_[k] for k in 1..n; keys_[0] unused
+    std::vector<std::pair<const Key, Value> > items_; // items_[k - 1]
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the FrozenIndex::iterator class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+FrozenIndex<Key, Value>::iterator::iterator() :
+    index_(NULL),
+    pos_(0)
+{
+
+}
+
+template<class Key, class Value>
+FrozenIndex<Key, Value>::iterator::iterator(const FrozenIndex<Key, Value>* index, size_t pos) :
+    index_(index),
+    pos_(pos)
+{
+
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> &
+FrozenIndex<Key, Value>::iterator::operator*() const
+{
+    return index_->items_[pos_ - 1];
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> *
+FrozenIndex<Key, Value>::iterator::operator->() const
+{
+    return &(index_->items_[pos_ - 1]);
+}
+
+/**
+* All end iterators compare equal, whichever index they came from.
+*/
+template<class Key, class Value>
+bool FrozenIndex<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return pos_ == rhs.pos_ && (pos_ == 0 || index_ == rhs.index_);
+}
+
+template<class Key, class Value>
+bool FrozenIndex<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value>
+typename FrozenIndex<Key, Value>::iterator&
+FrozenIndex<Key, Value>::iterator::operator++()
+{
+    pos_ = index_->successor(pos_);
+    return *this;
+}
+
+/*
+-----------------------------------------------
+End implementations for the FrozenIndex::iterator class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the FrozenIndex class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+FrozenIndex<Key, Value>::FrozenIndex() :
+    keys_(1)
+{
+
+}
+
+/**
+* Builds the index from n items in strictly ascending key order, such as
+* the in-order contents of a search tree.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+FrozenIndex<Key, Value>::FrozenIndex(ForwardIt first, ForwardIt last, size_t n) :
+    keys_(n + 1)
+{
+    // Visiting the Eytzinger positions in order pairs each one with the
+    // next sorted item. items_ can only be appended to, so remember the
+    // sources first and copy them out in position order afterwards.
+    std::vector<const std::pair<const Key, Value>*> sources(n + 1);
+    size_t pos = 1;
+    while (2 * pos <= n){
+        pos = 2 * pos;
+    }
+    for (; first != last && pos != 0; ++first){
+        sources[pos] = &*first;
+        keys_[pos] = first->first;
+        pos = successor(pos);
+    }
+
+    items_.reserve(n);
+    for (size_t k = 1; k <= n; ++k){
+        items_.push_back(*sources[k]);
+    }
+}
+
+template<class Key, class Value>
+bool FrozenIndex<Key, Value>::empty() const
+{
+    return items_.empty();
+}
+
+template<class Key, class Value>
+size_t FrozenIndex<Key, Value>::size() const
+{
+    return items_.size();
+}
+
+/**
+* The leftmost position of the implicit tree holds the smallest key.
+*/
+template<class Key, class Value>
+typename FrozenIndex<Key, Value>::iterator
+FrozenIndex<Key, Value>::begin() const
+{
+    size_t n = size();
+    if (n == 0){
+        return end();
+    }
+    size_t pos = 1;
+    while (2 * pos <= n){
+        pos = 2 * pos;
+    }
+    return iterator(this, pos);
+}
+
+template<class Key, class Value>
+typename FrozenIndex<Key, Value>::iterator
+FrozenIndex<Key, Value>::end() const
+{
+    return iterator(this, 0);
+}
+
+template<class Key, class Value>
+typename FrozenIndex<Key, Value>::iterator
+FrozenIndex<Key, Value>::find(const Key& key) const
+{
+    size_t pos = lowerBoundPos(key);
+    if (pos == 0 || key < keys_[pos]){
+        return end();
+    }
+    return iterator(this, pos);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value>
+typename FrozenIndex<Key, Value>::iterator
+FrozenIndex<Key, Value>::lowerBound(const Key& key) const
+{
+    return iterator(this, lowerBoundPos(key));
+}
+
+/**
+* @precondition The key exists in the index
+* Returns the value associated with the key
+*/
+template<class Key, class Value>
+Value const & FrozenIndex<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Descends the implicit tree without branching on the comparisons: each
+* step goes to 2k or 2k+1 depending on keys_[k] < key. On falling off
+* the bottom, the path's right turns after its last left turn are
+* undone, which leaves the last position where the descent went left,
+* i.e. the lower bound (0 if every key is less than key).
+*/
+template<class Key, class Value>
+size_t FrozenIndex<Key, Value>::lowerBoundPos(const Key& key) const
+{
+    const Key* keys = keys_.data();
+    size_t n = size();
+    size_t pos = 1;
+    while (pos <= n){
+#if defined(__GNUC__)
+        if (KEYS_PER_LINE * pos <= n){
+            __builtin_prefetch(keys + KEYS_PER_LINE * pos);
+        }
+#endif
+        pos = 2 * pos + (keys[pos] < key);
+    }
+#if defined(__GNUC__)
+    return pos >> __builtin_ffsll(~static_cast<unsigned long long>(pos));
+#else
+    while (pos & 1){
+        pos >>= 1;
+    }
+    return pos >> 1;
+#endif
+}
+
+/**
+* The next position in key order: the leftmost position of the right
+* subtree if there is one, otherwise the nearest ancestor reached from
+* its left child. Returns 0 past the largest key.
+*/
+template<class Key, class Value>
+size_t FrozenIndex<Key, Value>::successor(size_t pos) const
+{
+    size_t n = keys_.size() - 1;
+    if (2 * pos + 1 <= n){
+        pos = 2 * pos + 1;
+        while (2 * pos <= n){
+            pos = 2 * pos;
+        }
+        return pos;
+    }
+    while (pos & 1){
+        pos >>= 1;
+    }
+    return pos >> 1;
+}
+
+/*
+-----------------------------------------------
+End implementations for the FrozenIndex class.
+-----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,745 @@
+#ifndef INDEXED_AVL_H
+#define INDEXED_AVL_H
+
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+
+/**
+* An AVL tree whose nodes live in one contiguous vector and link to each
+* other by 32-bit index instead of by pointer.
+*
+* Each node keeps its item, the left, right and parent indices and a
+* balance byte. With 4-byte links a node holding 8-byte keys and values
+* takes 32 bytes instead of AVLTree's 48, and since no link depends on
+* where the vector sits in memory the whole tree is relocatable: growing
+* the array moves it without fixing any links, and copying a tree (a
+* snapshot) is one block copy of the array. A tree holds at most
+* 2^32 - 1 nodes; insert throws std::length_error beyond that.
+*
+* The array stays dense: remove moves the last node into the freed slot.
+* That move is why Key and Value must be trivially copyable (as for
+* TreeFile), and why an iterator stays valid across inserts but not
+* across removes. Like the vector it lives in, the array grows by
+* doubling; reserve() avoids the spare capacity when the size is known.
+*/
+template <typename Key, typename Value>
+class IndexedAVLTree
+{
+public:
+    typedef uint32_t Index;
+
+    // The missing child / parent; also end()'s index.
+    static const Index NIL = 0xffffffff;
+
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+        "nodes are moved and copied as raw bytes");
+
+protected:
+    typedef std::pair<const Key, Value> Item;
+
+    struct IndexedNode
+    {
+        Item& item() { return *reinterpret_cast<Item*>(&slot); }
+        const Item& item() const { return *reinterpret_cast<const Item*>(&slot); }
+
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type slot;
+        Index left;
+        Index right;
+        Index parent;
+        int8_t balance;     // right height minus left height
+    };
+
+public:
+    IndexedAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void reserve(size_t count);
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+    bool isValidAVL() const;
+
+    /**
+    * A bidirectional in-order iterator: the tree and a node index.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class IndexedAVLTree<Key, Value>;
+        iterator(const IndexedAVLTree<Key, Value>* tree, Index index);
+        const IndexedAVLTree<Key, Value>* tree_;
+        Index index_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    IndexedNode& at(Index index);
+    const IndexedNode& at(Index index) const;
+    Index findIndex(const Key& key) const;
+    Index smallest(Index index) const;
+    Index largest(Index index) const;
+    Index createNode(const Key& key, const Value& value, Index parent);
+    void releaseNode(Index index);
+    void replaceChild(Index parent, Index oldChild, Index newChild);
+    Index rotateLeft(Index index);
+    Index rotateRight(Index index);
+    Index rebalance(Index index);
+    void insertFix(Index index);
+    void removeFix(Index parent, bool leftShrank);
+    int checkHelp(Index index, Index parent, const Key* lo, const Key* hi) const;
+
+    std::vector<IndexedNode> nodes_;
+    Index root_;
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the IndexedAVLTree::iterator class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+IndexedAVLTree<Key, Value>::iterator::iterator() :
+    tree_(NULL),
+    index_(NIL)
+{
+
+}
+
+template<class Key, class Value>
+IndexedAVLTree<Key, Value>::iterator::iterator(const IndexedAVLTree<Key, Value>* tree, Index index) :
+    tree_(tree),
+    index_(index)
+{
+
+}
+
+template<class Key, class Value>
+std::pair<const Key,Value> &
+IndexedAVLTree<Key, Value>::iterator::operator*() const
+{
+    return const_cast<IndexedNode&>(tree_->at(index_)).item();
+}
+
+template<class Key, class Value>
+std::pair<const Key,Value> *
+IndexedAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &**this;
+}
+
+template<class Key, class Value>
+bool IndexedAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<class Key, class Value>
+bool IndexedAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+/**
+* Descends to the smallest item of the right subtree if there is one;
+* otherwise climbs until it arrives at an ancestor from the left.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator&
+IndexedAVLTree<Key, Value>::iterator::operator++()
+{
+    const IndexedNode& node = tree_->at(index_);
+    if (node.right != NIL){
+        index_ = tree_->smallest(node.right);
+        return *this;
+    }
+    Index child = index_;
+    index_ = node.parent;
+    while (index_ != NIL && tree_->at(index_).right == child){
+        child = index_;
+        index_ = tree_->at(index_).parent;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator
+IndexedAVLTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/**
+* The mirror image of operator++; from end() to the largest item.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator&
+IndexedAVLTree<Key, Value>::iterator::operator--()
+{
+    if (index_ == NIL){
+        index_ = tree_->largest(tree_->root_);
+        return *this;
+    }
+    const IndexedNode& node = tree_->at(index_);
+    if (node.left != NIL){
+        index_ = tree_->largest(node.left);
+        return *this;
+    }
+    Index child = index_;
+    index_ = node.parent;
+    while (index_ != NIL && tree_->at(index_).left == child){
+        child = index_;
+        index_ = tree_->at(index_).parent;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator
+IndexedAVLTree<Key, Value>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --*this;
+    return old;
+}
+
+/*
+-----------------------------------------------
+End implementations for the IndexedAVLTree::iterator class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the IndexedAVLTree class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+IndexedAVLTree<Key, Value>::IndexedAVLTree() :
+    root_(NIL)
+{
+
+}
+
+template<class Key, class Value>
+bool IndexedAVLTree<Key, Value>::empty() const
+{
+    return root_ == NIL;
+}
+
+template<class Key, class Value>
+size_t IndexedAVLTree<Key, Value>::size() const
+{
+    return nodes_.size();
+}
+
+/**
+* Height in nodes: 0 when empty. Follows the taller child down.
+*/
+template<class Key, class Value>
+int IndexedAVLTree<Key, Value>::height() const
+{
+    int h = 0;
+    for (Index index = root_; index != NIL; ++h){
+        const IndexedNode& node = at(index);
+        index = node.balance < 0 ? node.left : node.right;
+    }
+    return h;
+}
+
+/**
+* Checks ordering, parent links, stored balances and AVL balance.
+*/
+template<class Key, class Value>
+bool IndexedAVLTree<Key, Value>::isValidAVL() const
+{
+    return checkHelp(root_, NIL, NULL, NULL) >= 0;
+}
+
+/**
+* Removes every item; the items need no destructor, so this only empties
+* the array and keeps its capacity.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::clear()
+{
+    nodes_.clear();
+    root_ = NIL;
+}
+
+/**
+* Makes room for count nodes so inserts up to that size never move the
+* array.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::reserve(size_t count)
+{
+    nodes_.reserve(count);
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator
+IndexedAVLTree<Key, Value>::begin() const
+{
+    return iterator(this, smallest(root_));
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator
+IndexedAVLTree<Key, Value>::end() const
+{
+    return iterator(this, NIL);
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::reverse_iterator
+IndexedAVLTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::reverse_iterator
+IndexedAVLTree<Key, Value>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns an iterator to the key's item, or end() if it is not present.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator
+IndexedAVLTree<Key, Value>::find(const Key& key) const
+{
+    return iterator(this, findIndex(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::iterator
+IndexedAVLTree<Key, Value>::lowerBound(const Key& key) const
+{
+    Index found = NIL;
+    for (Index index = root_; index != NIL; ){
+        const IndexedNode& node = at(index);
+        if (node.item().first < key){
+            index = node.right;
+        }
+        else {
+            found = index;
+            index = node.left;
+        }
+    }
+    return iterator(this, found);
+}
+
+/**
+* Throws std::out_of_range if the key is not present.
+*/
+template<class Key, class Value>
+Value& IndexedAVLTree<Key, Value>::operator[](const Key& key)
+{
+    Index index = findIndex(key);
+    if (index == NIL) throw std::out_of_range("Invalid key");
+    return at(index).item().second;
+}
+
+template<class Key, class Value>
+Value const & IndexedAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    Index index = findIndex(key);
+    if (index == NIL) throw std::out_of_range("Invalid key");
+    return at(index).item().second;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if (root_ == NIL){
+        root_ = createNode(key, keyValuePair.second, NIL);
+        return;
+    }
+    Index parent;
+    bool leftward;
+    Index index = root_;
+    do {
+        IndexedNode& node = at(index);
+        if (key == node.item().first){
+            node.item().second = keyValuePair.second;
+            return;
+        }
+        parent = index;
+        leftward = key < node.item().first;
+        index = leftward ? node.left : node.right;
+    } while (index != NIL);
+
+    // createNode may move the array, so no references are held across it
+    Index added = createNode(key, keyValuePair.second, parent);
+    if (leftward){
+        at(parent).left = added;
+    }
+    else {
+        at(parent).right = added;
+    }
+    insertFix(added);
+}
+
+/**
+* Removes the key's item if it is present. A node with two children takes
+* over its successor's item and the successor's node is unlinked instead.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::remove(const Key& key)
+{
+    Index index = findIndex(key);
+    if (index == NIL){
+        return;
+    }
+    if (at(index).left != NIL && at(index).right != NIL){
+        Index successor = smallest(at(index).right);
+        at(index).slot = at(successor).slot;
+        index = successor;
+    }
+
+    IndexedNode& node = at(index);
+    Index child = node.left != NIL ? node.left : node.right;
+    Index parent = node.parent;
+    if (child != NIL){
+        at(child).parent = parent;
+    }
+    if (parent == NIL){
+        root_ = child;
+    }
+    else {
+        bool leftShrank = at(parent).left == index;
+        replaceChild(parent, index, child);
+        removeFix(parent, leftShrank);
+    }
+    releaseNode(index);
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::IndexedNode&
+IndexedAVLTree<Key, Value>::at(Index index)
+{
+    return nodes_[index];
+}
+
+template<class Key, class Value>
+const typename IndexedAVLTree<Key, Value>::IndexedNode&
+IndexedAVLTree<Key, Value>::at(Index index) const
+{
+    return nodes_[index];
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::findIndex(const Key& key) const
+{
+    // as in CompactAVLTree::findNode, the child choice becomes a
+    // conditional move
+    Index index = root_;
+    while (index != NIL && !(key == at(index).item().first)){
+        index = key < at(index).item().first ? at(index).left : at(index).right;
+    }
+    return index;
+}
+
+/**
+* The index of the smallest item below index, or NIL if index is NIL.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::smallest(Index index) const
+{
+    if (index == NIL){
+        return NIL;
+    }
+    while (at(index).left != NIL){
+        index = at(index).left;
+    }
+    return index;
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::largest(Index index) const
+{
+    if (index == NIL){
+        return NIL;
+    }
+    while (at(index).right != NIL){
+        index = at(index).right;
+    }
+    return index;
+}
+
+/**
+* Appends an unlinked node below parent and returns its index.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::createNode(const Key& key, const Value& value, Index parent)
+{
+    if (nodes_.size() >= NIL){
+        throw std::length_error("IndexedAVLTree is full");
+    }
+    nodes_.push_back(IndexedNode());
+    IndexedNode& node = nodes_.back();
+    new (&node.slot) Item(key, value);
+    node.left = NIL;
+    node.right = NIL;
+    node.parent = parent;
+    node.balance = 0;
+    return static_cast<Index>(nodes_.size() - 1);
+}
+
+/**
+* Frees the slot of an unlinked node by moving the last node into it and
+* pointing that node's neighbours at its new index.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::releaseNode(Index index)
+{
+    Index last = static_cast<Index>(nodes_.size() - 1);
+    if (index != last){
+        IndexedNode& moved = at(index);
+        moved = at(last);
+        if (moved.parent == NIL){
+            root_ = index;
+        }
+        else {
+            replaceChild(moved.parent, last, index);
+        }
+        if (moved.left != NIL){
+            at(moved.left).parent = index;
+        }
+        if (moved.right != NIL){
+            at(moved.right).parent = index;
+        }
+    }
+    nodes_.pop_back();
+}
+
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::replaceChild(Index parent, Index oldChild, Index newChild)
+{
+    IndexedNode& node = at(parent);
+    if (node.left == oldChild){
+        node.left = newChild;
+    }
+    else {
+        node.right = newChild;
+    }
+}
+
+/**
+* Rotates index's right child above it and returns the child. The
+* balances follow from the old ones without looking at any heights.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::rotateLeft(Index index)
+{
+    IndexedNode& node = at(index);
+    Index child = node.right;
+    IndexedNode& up = at(child);
+    Index parent = node.parent;
+
+    node.right = up.left;
+    if (up.left != NIL){
+        at(up.left).parent = index;
+    }
+    up.left = index;
+    node.parent = child;
+    up.parent = parent;
+    if (parent == NIL){
+        root_ = child;
+    }
+    else {
+        replaceChild(parent, index, child);
+    }
+
+    node.balance = node.balance - 1 - std::max<int8_t>(up.balance, 0);
+    up.balance = up.balance - 1 + std::min<int8_t>(node.balance, 0);
+    return child;
+}
+
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::rotateRight(Index index)
+{
+    IndexedNode& node = at(index);
+    Index child = node.left;
+    IndexedNode& up = at(child);
+    Index parent = node.parent;
+
+    node.left = up.right;
+    if (up.right != NIL){
+        at(up.right).parent = index;
+    }
+    up.right = index;
+    node.parent = child;
+    up.parent = parent;
+    if (parent == NIL){
+        root_ = child;
+    }
+    else {
+        replaceChild(parent, index, child);
+    }
+
+    node.balance = node.balance + 1 - std::min<int8_t>(up.balance, 0);
+    up.balance = up.balance + 1 + std::max<int8_t>(node.balance, 0);
+    return child;
+}
+
+/**
+* Restores a node whose balance reached -2 or 2 with a single or double
+* rotation and returns the subtree's new root.
+*/
+template<class Key, class Value>
+typename IndexedAVLTree<Key, Value>::Index
+IndexedAVLTree<Key, Value>::rebalance(Index index)
+{
+    if (at(index).balance < 0){
+        if (at(at(index).left).balance > 0){
+            rotateLeft(at(index).left);
+        }
+        return rotateRight(index);
+    }
+    if (at(at(index).right).balance < 0){
+        rotateRight(at(index).right);
+    }
+    return rotateLeft(index);
+}
+
+/**
+* Walks up from a new leaf while subtrees keep getting taller. One
+* rotation at most restores the balance, after which nothing above
+* changes.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::insertFix(Index index)
+{
+    for (Index parent = at(index).parent; parent != NIL; index = parent, parent = at(parent).parent){
+        IndexedNode& node = at(parent);
+        node.balance += node.left == index ? -1 : 1;
+        if (node.balance == 0){
+            return;
+        }
+        if (node.balance == -2 || node.balance == 2){
+            rebalance(parent);
+            return;
+        }
+    }
+}
+
+/**
+* Walks up from the parent of an unlinked node while subtrees keep
+* getting shorter. A rotation only stops the walk when it leaves its
+* subtree's height unchanged, i.e. the new root is not balanced.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::removeFix(Index parent, bool leftShrank)
+{
+    while (parent != NIL){
+        IndexedNode& node = at(parent);
+        node.balance += leftShrank ? 1 : -1;
+        if (node.balance == -1 || node.balance == 1){
+            return;
+        }
+        if (node.balance != 0){
+            parent = rebalance(parent);
+            if (at(parent).balance != 0){
+                return;
+            }
+        }
+        Index grandparent = at(parent).parent;
+        if (grandparent != NIL){
+            leftShrank = at(grandparent).left == parent;
+        }
+        parent = grandparent;
+    }
+}
+
+/**
+* Returns the height of index's subtree, or -1 if anything in it is out
+* of order, out of balance or wrongly linked.
+*/
+template<class Key, class Value>
+int IndexedAVLTree<Key, Value>::checkHelp(Index index, Index parent, const Key* lo, const Key* hi) const
+{
+    if (index == NIL){
+        return 0;
+    }
+    const IndexedNode& node = at(index);
+    const Key& key = node.item().first;
+    if (node.parent != parent || (lo != NULL && !(*lo < key)) || (hi != NULL && !(key < *hi))){
+        return -1;
+    }
+    int lh = checkHelp(node.left, index, lo, &key);
+    int rh = checkHelp(node.right, index, &key, hi);
+    if (lh < 0 || rh < 0 || rh - lh != node.balance || lh - rh > 1 || rh - lh > 1){
+        return -1;
+    }
+    return 1 + (lh > rh ? lh : rh);
+}
+
+/*
+-----------------------------------------------
+End implementations for the IndexedAVLTree class.
+-----------------------------------------------
+*/
+
+#endif
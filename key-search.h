@@ -0,0 +1,179 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#if (defined(__AVX2__) || defined(__SSE4_2__)) && defined(__x86_64__)
+#define KEY_SEARCH_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+* Search within one node's sorted key array.
+*
+* KeySearch<Key>::upperBound<Slots>(keys, n, key) returns how many of
+* keys[0..n) are not greater than key, which is the index of the child to
+* descend into in a B-tree inner node. Slots is the length of the key
+* array, a multiple of LANES.
+*
+* The generic version is a branch-free binary search and works for any
+* Key with operator<. Integral keys of 4 or 8 bytes are specialized to
+* compare a whole vector of keys per instruction when the compiler targets
+* AVX2 (8 or 4 keys) or SSE4.2 (4 or 2 keys), e.g. with -march=native.
+* The vector versions scan all Slots keys and ignore the ones past n:
+* a fixed trip count unrolls fully, where stopping at n would mispredict
+* the loop exit on every node. Past 16 vectors per node the full scan
+* costs more than a binary search, so such nodes use the scalar version.
+*/
+template <typename Key>
+struct ScalarKeySearch
+{
+    static const size_t LANES = 1;
+
+    template<size_t Slots>
+    static size_t upperBound(const Key* keys, size_t n, const Key& key)
+    {
+        size_t base = 0;
+        while (n > 1){
+            size_t half = n / 2;
+            base = key < keys[base + half - 1] ? base : base + half;
+            n -= half;
+        }
+        return n == 0 ? base : base + !(key < keys[base]);
+    }
+};
+
+template <typename Key, typename Enable = void>
+struct KeySearch : ScalarKeySearch<Key>
+{
+
+};
+
+#ifdef KEY_SEARCH_SIMD
+
+/**
+* 32-bit integral keys. Each block of keys is compared against key and
+* against the count at once, and the lanes that are both in range and not
+* greater are summed in a vector register; only the final total is moved
+* back to a scalar. Unsigned keys are compared as signed after flipping
+* their sign bit, since the vector compares are signed.
+*/
+template <typename Key>
+struct KeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && sizeof(Key) == 4>::type>
+{
+#if defined(__AVX2__)
+    static const size_t LANES = 8;
+
+    template<size_t Slots>
+    static size_t upperBound(const Key* keys, size_t n, const Key& key)
+    {
+        if (Slots / LANES > 16){
+            return ScalarKeySearch<Key>::template upperBound<Slots>(keys, n, key);
+        }
+        const __m256i bias = _mm256_set1_epi32(std::is_signed<Key>::value ? 0 : INT32_MIN);
+        const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(int32_t(key)), bias);
+        const __m256i limit = _mm256_set1_epi32(int32_t(n));
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i count = _mm256_setzero_si256();
+        for (size_t i = 0; i < Slots; i += LANES){
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            __m256i greater = _mm256_cmpgt_epi32(_mm256_xor_si256(block, bias), needle);
+            __m256i valid = _mm256_cmpgt_epi32(limit, lane);
+            count = _mm256_sub_epi32(count, _mm256_andnot_si256(greater, valid));
+            lane = _mm256_add_epi32(lane, _mm256_set1_epi32(LANES));
+        }
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+        return size_t(_mm_cvtsi128_si32(sum));
+    }
+#else
+    static const size_t LANES = 4;
+
+    template<size_t Slots>
+    static size_t upperBound(const Key* keys, size_t n, const Key& key)
+    {
+        if (Slots / LANES > 16){
+            return ScalarKeySearch<Key>::template upperBound<Slots>(keys, n, key);
+        }
+        const __m128i bias = _mm_set1_epi32(std::is_signed<Key>::value ? 0 : INT32_MIN);
+        const __m128i needle = _mm_xor_si128(_mm_set1_epi32(int32_t(key)), bias);
+        const __m128i limit = _mm_set1_epi32(int32_t(n));
+        __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i count = _mm_setzero_si128();
+        for (size_t i = 0; i < Slots; i += LANES){
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            __m128i greater = _mm_cmpgt_epi32(_mm_xor_si128(block, bias), needle);
+            __m128i valid = _mm_cmpgt_epi32(limit, lane);
+            count = _mm_sub_epi32(count, _mm_andnot_si128(greater, valid));
+            lane = _mm_add_epi32(lane, _mm_set1_epi32(LANES));
+        }
+        count = _mm_add_epi32(count, _mm_shuffle_epi32(count, 0x4E));
+        count = _mm_add_epi32(count, _mm_shuffle_epi32(count, 0xB1));
+        return size_t(_mm_cvtsi128_si32(count));
+    }
+#endif
+};
+
+/**
+* 64-bit integral keys, the same way; the 64-bit compare needs SSE4.2.
+*/
+template <typename Key>
+struct KeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && sizeof(Key) == 8>::type>
+{
+#if defined(__AVX2__)
+    static const size_t LANES = 4;
+
+    template<size_t Slots>
+    static size_t upperBound(const Key* keys, size_t n, const Key& key)
+    {
+        if (Slots / LANES > 16){
+            return ScalarKeySearch<Key>::template upperBound<Slots>(keys, n, key);
+        }
+        const __m256i bias = _mm256_set1_epi64x(std::is_signed<Key>::value ? 0 : INT64_MIN);
+        const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(int64_t(key)), bias);
+        const __m256i limit = _mm256_set1_epi64x(int64_t(n));
+        __m256i lane = _mm256_setr_epi64x(0, 1, 2, 3);
+        __m256i count = _mm256_setzero_si256();
+        for (size_t i = 0; i < Slots; i += LANES){
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            __m256i greater = _mm256_cmpgt_epi64(_mm256_xor_si256(block, bias), needle);
+            __m256i valid = _mm256_cmpgt_epi64(limit, lane);
+            count = _mm256_sub_epi64(count, _mm256_andnot_si256(greater, valid));
+            lane = _mm256_add_epi64(lane, _mm256_set1_epi64x(LANES));
+        }
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+        return size_t(_mm_cvtsi128_si64(sum));
+    }
+#else
+    static const size_t LANES = 2;
+
+    template<size_t Slots>
+    static size_t upperBound(const Key* keys, size_t n, const Key& key)
+    {
+        if (Slots / LANES > 16){
+            return ScalarKeySearch<Key>::template upperBound<Slots>(keys, n, key);
+        }
+        const __m128i bias = _mm_set1_epi64x(std::is_signed<Key>::value ? 0 : INT64_MIN);
+        const __m128i needle = _mm_xor_si128(_mm_set1_epi64x(int64_t(key)), bias);
+        const __m128i limit = _mm_set1_epi64x(int64_t(n));
+        __m128i lane = _mm_set_epi64x(1, 0);
+        __m128i count = _mm_setzero_si128();
+        for (size_t i = 0; i < Slots; i += LANES){
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            __m128i greater = _mm_cmpgt_epi64(_mm_xor_si128(block, bias), needle);
+            __m128i valid = _mm_cmpgt_epi64(limit, lane);
+            count = _mm_sub_epi64(count, _mm_andnot_si128(greater, valid));
+            lane = _mm_add_epi64(lane, _mm_set1_epi64x(LANES));
+        }
+        count = _mm_add_epi64(count, _mm_unpackhi_epi64(count, count));
+        return size_t(_mm_cvtsi128_si64(count));
+    }
+#endif
+};
+
+#endif
+
+#endif
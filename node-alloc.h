@@ -0,0 +1,176 @@
+#ifndef NODE_ALLOC_H
+#define NODE_ALLOC_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Node allocation policies for BinarySearchTree and AVLTree.
+ *
+ * A policy hands out raw storage for exactly one node at a time. The tree
+ * placement-constructs the node into it and destroys it again before
+ * handing the storage back, so a policy never needs to know the concrete
+ * node type.
+ *
+ * Every policy provides:
+ *   void* allocate(std::size_t bytes);
+ *   void  deallocate(void* p);
+ *   void  release();             // drop every outstanding allocation
+ *   static const bool bulkRelease;
+ *
+ * When bulkRelease is true, clear() may skip the per-node deallocate and
+ * free everything with a single release().
+ */
+
+/**
+ * The default policy: one global operator new/delete per node, which is
+ * exactly what the trees did before policies existed.
+ */
+class HeapNodeAllocator
+{
+public:
+    static const bool bulkRelease = false;
+
+    void* allocate(std::size_t bytes)
+    {
+        return ::operator new(bytes);
+    }
+
+    void deallocate(void* p)
+    {
+        ::operator delete(p);
+    }
+
+    void release()
+    {
+        // Individual nodes are not tracked, so there is nothing to do here.
+    }
+};
+
+/**
+ * A slab allocator that carves nodes out of large contiguous blocks.
+ * Freed nodes go onto an intrusive free list and are reused before a new
+ * block is requested; release() hands all blocks back at once.
+ *
+ * The slot size is fixed by the first allocation, since a tree only ever
+ * allocates one kind of node. The pool owns its blocks, so it cannot be
+ * copied.
+ */
+template <std::size_t NodesPerBlock = 1024>
+class PoolNodeAllocator
+{
+public:
+    static const bool bulkRelease = true;
+
+    PoolNodeAllocator();
+    ~PoolNodeAllocator();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p);
+    void release();
+
+private:
+    PoolNodeAllocator(const PoolNodeAllocator&);
+    PoolNodeAllocator& operator=(const PoolNodeAllocator&);
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    void addBlock();
+
+    std::vector<char*> blocks_;
+    FreeSlot* freeList_;
+    char* bump_;        // next never-used slot in the newest block
+    char* blockEnd_;
+    std::size_t slotSize_;
+};
+
+template <std::size_t NodesPerBlock>
+PoolNodeAllocator<NodesPerBlock>::PoolNodeAllocator() :
+    freeList_(NULL),
+    bump_(NULL),
+    blockEnd_(NULL),
+    slotSize_(0)
+{
+
+}
+
+template <std::size_t NodesPerBlock>
+PoolNodeAllocator<NodesPerBlock>::~PoolNodeAllocator()
+{
+    release();
+}
+
+/**
+* Returns storage for one node, preferring a recycled slot.
+*/
+template <std::size_t NodesPerBlock>
+void* PoolNodeAllocator<NodesPerBlock>::allocate(std::size_t bytes)
+{
+    if (slotSize_ == 0){
+        // round up so every slot stays aligned for the node type
+        const std::size_t align = sizeof(void*) > alignof(std::max_align_t) ?
+            sizeof(void*) : alignof(std::max_align_t);
+        std::size_t size = bytes < sizeof(FreeSlot) ? sizeof(FreeSlot) : bytes;
+        slotSize_ = (size + align - 1) / align * align;
+    }
+    else if (bytes > slotSize_){
+        throw std::bad_alloc();
+    }
+
+    if (freeList_ != NULL){
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        return slot;
+    }
+    if (bump_ == blockEnd_){
+        addBlock();
+    }
+    void* p = bump_;
+    bump_ += slotSize_;
+    return p;
+}
+
+/**
+* Puts a slot back on the free list; the block itself stays allocated.
+*/
+template <std::size_t NodesPerBlock>
+void PoolNodeAllocator<NodesPerBlock>::deallocate(void* p)
+{
+    if (p == NULL){
+        return;
+    }
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = freeList_;
+    freeList_ = slot;
+}
+
+/**
+* Frees every block. Any node still living in the pool must already
+* have been destroyed.
+*/
+template <std::size_t NodesPerBlock>
+void PoolNodeAllocator<NodesPerBlock>::release()
+{
+    for (std::size_t i = 0; i < blocks_.size(); ++i){
+        ::operator delete(blocks_[i]);
+    }
+    blocks_.clear();
+    freeList_ = NULL;
+    bump_ = NULL;
+    blockEnd_ = NULL;
+}
+
+template <std::size_t NodesPerBlock>
+void PoolNodeAllocator<NodesPerBlock>::addBlock()
+{
+    char* block = static_cast<char*>(::operator new(slotSize_ * NodesPerBlock));
+    blocks_.push_back(block);
+    bump_ = block;
+    blockEnd_ = block + slotSize_ * NodesPerBlock;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "thread-pool.h"
+
+/**
+* A merge sort that spreads both the recursive sorts and the merges over
+* a ThreadPool.
+*
+* The halves are sorted in parallel, alternating between the input and a
+* scratch buffer so every level merges straight into the other buffer
+* without copying back. A merge splits around the middle element of its
+* longer input, binary-searches the matching position in the shorter one
+* and merges the two sides in parallel, so the span stays polylogarithmic
+* instead of ending in one long sequential merge. Below GRAIN elements
+* the work stays on one thread and std::sort and std::merge take over.
+*
+* The sort is not stable; make ties impossible (e.g. by comparing
+* positions last) where their order matters. T must be default
+* constructible and assignable.
+*/
+template <typename T, typename Less>
+struct ParallelSorter
+{
+    static const size_t GRAIN = 1 << 14;
+
+    static void sort(std::vector<T>& items, Less less, ThreadPool* pool)
+    {
+        if (pool == NULL || items.size() <= GRAIN){
+            std::sort(items.begin(), items.end(), less);
+            return;
+        }
+        std::vector<T> scratch(items.size());
+        sortInto(items.data(), scratch.data(), items.size(), false, less, pool);
+    }
+
+    /**
+    * Sorts the n elements at data; the result ends up in scratch if
+    * toScratch is set, in data otherwise.
+    */
+    static void sortInto(T* data, T* scratch, size_t n, bool toScratch, Less less, ThreadPool* pool)
+    {
+        if (n <= GRAIN){
+            std::sort(data, data + n, less);
+            if (toScratch){
+                std::copy(data, data + n, scratch);
+            }
+            return;
+        }
+        size_t half = n / 2;
+        pool->parallelInvoke(
+            [=]() { sortInto(data, scratch, half, !toScratch, less, pool); },
+            [=]() { sortInto(data + half, scratch + half, n - half, !toScratch, less, pool); });
+        T* from = toScratch ? data : scratch;
+        T* to = toScratch ? scratch : data;
+        merge(from, half, from + half, n - half, to, less, pool);
+    }
+
+    /**
+    * Merges the sorted runs a and b into out.
+    */
+    static void merge(const T* a, size_t aCount, const T* b, size_t bCount, T* out, Less less, ThreadPool* pool)
+    {
+        if (aCount < bCount){
+            std::swap(a, b);
+            std::swap(aCount, bCount);
+        }
+        if (aCount + bCount <= GRAIN){
+            std::merge(a, a + aCount, b, b + bCount, out, less);
+            return;
+        }
+        size_t aMid = aCount / 2;
+        size_t bMid = std::lower_bound(b, b + bCount, a[aMid], less) - b;
+        out[aMid + bMid] = a[aMid];
+        pool->parallelInvoke(
+            [=]() { merge(a, aMid, b, bMid, out, less, pool); },
+            [=]() { merge(a + aMid + 1, aCount - aMid - 1, b + bMid, bCount - bMid,
+                          out + aMid + bMid + 1, less, pool); });
+    }
+};
+
+/**
+* Sorts items with less on pool, or with std::sort if pool is NULL.
+*/
+template <typename T, typename Less>
+void parallelSort(std::vector<T>& items, Less less, ThreadPool* pool)
+{
+    ParallelSorter<T, Less>::sort(items, less, pool);
+}
+
+#endif
@@ -0,0 +1,609 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <atomic>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <cstdlib>
+
+/**
+* An immutable AVL tree: every version stays readable after it has been
+* "updated", so any version can serve as a point-in-time snapshot.
+*
+* insert and remove leave the tree untouched and return a new version.
+* The new version copies only the nodes on the path to the change, plus
+* the few a rebalancing rotation rearranges, so an update allocates
+* O(log n) nodes and shares every other subtree with the old version.
+*
+* Nodes are reference counted, one reference per parent and one per
+* version whose root it is. Copying a version (taking a snapshot) costs a
+* single increment, and a node is freed as soon as the last version
+* sharing it is destroyed. The counts are atomic, so versions can be
+* handed to and released on other threads; a single PersistentAVLTree
+* object is not to be assigned while another thread reads it.
+*
+* If an update throws (from allocation or from copying a Key or Value),
+* the nodes it had made are freed again and every existing version is
+* left as it was.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+protected:
+    struct PersistentNode
+    {
+        PersistentNode(const std::pair<const Key, Value>& item,
+                       const PersistentNode* left, const PersistentNode* right) :
+            item(item), left(left), right(right),
+            height(1 + (PersistentAVLTree::height(left) > PersistentAVLTree::height(right) ?
+                        PersistentAVLTree::height(left) : PersistentAVLTree::height(right))),
+            refs(1)
+        {
+
+        }
+
+        const std::pair<const Key, Value> item;
+        const PersistentNode* const left;    // one reference owned
+        const PersistentNode* const right;   // one reference owned
+        const int height;                    // leaves have height 1
+        mutable std::atomic<size_t> refs;
+    };
+
+public:
+    // Deepest possible AVL tree holding 2^64 nodes.
+    static const int MAX_HEIGHT = 96;
+
+    PersistentAVLTree();
+    template<typename ForwardIt>
+    PersistentAVLTree(ForwardIt first, ForwardIt last);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree(PersistentAVLTree&& other);
+    PersistentAVLTree& operator=(PersistentAVLTree other);
+    ~PersistentAVLTree();
+
+    PersistentAVLTree insert(const std::pair<const Key, Value>& keyValuePair) const;
+    PersistentAVLTree remove(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+    bool isValidAVL() const;
+
+    /**
+    * An in-order iterator. It stays valid as long as the version it came
+    * from (or any version sharing the node it points to) is alive.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        explicit iterator(const PersistentNode* root);
+        void pushLeftSpine(const PersistentNode* node);
+
+        // The current node is on top; the rest are the ancestors still
+        // to be visited, so stepping needs no parent pointers.
+        const PersistentNode* stack_[MAX_HEIGHT];
+        int depth_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+protected:
+    PersistentAVLTree(const PersistentNode* root, size_t size);
+
+    static int height(const PersistentNode* node);
+    static const PersistentNode* retain(const PersistentNode* node);
+    static void release(const PersistentNode* node);
+    static const PersistentNode* makeNode(const std::pair<const Key, Value>& item,
+                                          const PersistentNode* left, const PersistentNode* right);
+    static const PersistentNode* balance(const std::pair<const Key, Value>& item,
+                                         const PersistentNode* left, const PersistentNode* right);
+    static const PersistentNode* insertHelp(const PersistentNode* node,
+                                            const std::pair<const Key, Value>& keyValuePair, bool& inserted);
+    static const PersistentNode* removeHelp(const PersistentNode* node, const Key& key);
+    static const PersistentNode* removeMin(const PersistentNode* node, const PersistentNode*& min);
+    template<typename ForwardIt>
+    static const PersistentNode* buildSubtree(ForwardIt& it, size_t count);
+    static int checkHelp(const PersistentNode* node, const Key* lo, const Key* hi);
+
+    const PersistentNode* root_;    // one reference owned
+    size_t size_;
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the PersistentAVLTree::iterator class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::iterator::iterator() :
+    depth_(0)
+{
+
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::iterator::iterator(const PersistentNode* root) :
+    depth_(0)
+{
+    pushLeftSpine(root);
+}
+
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::iterator::pushLeftSpine(const PersistentNode* node)
+{
+    for (; node != NULL; node = node->left){
+        stack_[depth_++] = node;
+    }
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> &
+PersistentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return stack_[depth_ - 1]->item;
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> *
+PersistentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(stack_[depth_ - 1]->item);
+}
+
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return depth_ == rhs.depth_ && (depth_ == 0 || stack_[depth_ - 1] == rhs.stack_[depth_ - 1]);
+}
+
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Pops the current node and descends into its right subtree, if any.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator&
+PersistentAVLTree<Key, Value>::iterator::operator++()
+{
+    const PersistentNode* node = stack_[--depth_];
+    pushLeftSpine(node->right);
+    return *this;
+}
+
+/*
+-----------------------------------------------
+End implementations for the PersistentAVLTree::iterator class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Builds a perfectly balanced tree from items in strictly ascending key
+* order, such as the contents of another tree.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(ForwardIt first, ForwardIt last) :
+    root_(NULL),
+    size_(std::distance(first, last))
+{
+    root_ = buildSubtree(first, size_);
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(const PersistentNode* root, size_t size) :
+    root_(root),
+    size_(size)
+{
+
+}
+
+/**
+* Takes a snapshot: the copy shares every node with other.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(retain(other.root_)),
+    size_(other.size_)
+{
+
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(PersistentAVLTree&& other) :
+    root_(other.root_),
+    size_(other.size_)
+{
+    other.root_ = NULL;
+    other.size_ = 0;
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>&
+PersistentAVLTree<Key, Value>::operator=(PersistentAVLTree other)
+{
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    return *this;
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Returns a version with the pair inserted, or with the key's value
+* overwritten if it is already present.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>
+PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair) const
+{
+    bool inserted = false;
+    const PersistentNode* root = insertHelp(root_, keyValuePair, inserted);
+    return PersistentAVLTree(root, size_ + inserted);
+}
+
+/**
+* Returns a version without the key. If the key is not present, the
+* result shares this version's root and nothing is copied.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>
+PersistentAVLTree<Key, Value>::remove(const Key& key) const
+{
+    if (find(key) == end()){
+        return *this;
+    }
+    return PersistentAVLTree(removeHelp(root_, key), size_ - 1);
+}
+
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value>
+size_t PersistentAVLTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value>
+int PersistentAVLTree<Key, Value>::height() const
+{
+    return height(root_);
+}
+
+/**
+* Checks ordering, stored heights and AVL balance.
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::isValidAVL() const
+{
+    return checkHelp(root_, NULL, NULL) >= 0;
+}
+
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::begin() const
+{
+    return iterator(root_);
+}
+
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+/**
+* Records the path from the root so the iterator can continue in order
+* from the found node.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    iterator it;
+    const PersistentNode* node = root_;
+    while (node != NULL){
+        if (key < node->item.first){
+            // node is still to be visited after the left subtree
+            it.stack_[it.depth_++] = node;
+            node = node->left;
+        }
+        else if (node->item.first < key){
+            node = node->right;
+        }
+        else {
+            it.stack_[it.depth_++] = node;
+            return it;
+        }
+    }
+    return end();
+}
+
+/**
+* @precondition The key exists in the tree
+* Returns the value associated with the key
+*/
+template<class Key, class Value>
+Value const & PersistentAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value>
+int PersistentAVLTree<Key, Value>::height(const PersistentNode* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::retain(const PersistentNode* node)
+{
+    if (node != NULL){
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops one reference, freeing the node and releasing its children when
+* it was the last. The descent follows one child iteratively, so only
+* the other recurses.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::release(const PersistentNode* node)
+{
+    while (node != NULL && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        const PersistentNode* right = node->right;
+        release(node->left);
+        delete node;
+        node = right;
+    }
+}
+
+/**
+* Makes a node holding item over left and right, taking over the caller's
+* references to them. If allocating the node or copying the item throws,
+* those references are released before the exception propagates.
+*/
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::makeNode(const std::pair<const Key, Value>& item,
+                                        const PersistentNode* left, const PersistentNode* right)
+{
+    try {
+        return new PersistentNode(item, left, right);
+    }
+    catch (...) {
+        release(left);
+        release(right);
+        throw;
+    }
+}
+
+/**
+* Makes a node holding item over left and right, whose heights differ by
+* at most two, rotating so that the result is balanced. Takes over the
+* caller's references to left and right and returns a new reference.
+* Nodes a rotation rearranges are copied, never modified.
+*/
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::balance(const std::pair<const Key, Value>& item,
+                                       const PersistentNode* left, const PersistentNode* right)
+{
+    int lh = height(left);
+    int rh = height(right);
+    if (lh <= rh + 1 && rh <= lh + 1){
+        return makeNode(item, left, right);
+    }
+
+    // Each new node gets fresh references, so if one throws only the
+    // nodes made so far and the caller's left and right are released.
+    const PersistentNode* lower = NULL;
+    const PersistentNode* upper = NULL;
+    const PersistentNode* result;
+    try {
+        if (lh > rh){
+            if (height(left->left) >= height(left->right)){
+                lower = makeNode(item, retain(left->right), retain(right));
+                result = makeNode(left->item, retain(left->left), retain(lower));
+            }
+            else {
+                const PersistentNode* pivot = left->right;
+                lower = makeNode(left->item, retain(left->left), retain(pivot->left));
+                upper = makeNode(item, retain(pivot->right), retain(right));
+                result = makeNode(pivot->item, retain(lower), retain(upper));
+            }
+        }
+        else {
+            if (height(right->right) >= height(right->left)){
+                lower = makeNode(item, retain(left), retain(right->left));
+                result = makeNode(right->item, retain(lower), retain(right->right));
+            }
+            else {
+                const PersistentNode* pivot = right->left;
+                lower = makeNode(item, retain(left), retain(pivot->left));
+                upper = makeNode(right->item, retain(pivot->right), retain(right->right));
+                result = makeNode(pivot->item, retain(lower), retain(upper));
+            }
+        }
+    }
+    catch (...) {
+        release(lower);
+        release(upper);
+        release(left);
+        release(right);
+        throw;
+    }
+    release(lower);
+    release(upper);
+    release(left);
+    release(right);
+    return result;
+}
+
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::insertHelp(const PersistentNode* node,
+                                          const std::pair<const Key, Value>& keyValuePair, bool& inserted)
+{
+    if (node == NULL){
+        inserted = true;
+        return makeNode(keyValuePair, NULL, NULL);
+    }
+    // the new child is made before the sibling is retained, so nothing
+    // is held if making it throws
+    if (keyValuePair.first < node->item.first){
+        const PersistentNode* left = insertHelp(node->left, keyValuePair, inserted);
+        return balance(node->item, left, retain(node->right));
+    }
+    if (node->item.first < keyValuePair.first){
+        const PersistentNode* right = insertHelp(node->right, keyValuePair, inserted);
+        return balance(node->item, retain(node->left), right);
+    }
+    return makeNode(keyValuePair, retain(node->left), retain(node->right));
+}
+
+/**
+* @precondition key is present below node
+*/
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::removeHelp(const PersistentNode* node, const Key& key)
+{
+    if (key < node->item.first){
+        const PersistentNode* left = removeHelp(node->left, key);
+        return balance(node->item, left, retain(node->right));
+    }
+    if (node->item.first < key){
+        const PersistentNode* right = removeHelp(node->right, key);
+        return balance(node->item, retain(node->left), right);
+    }
+    if (node->left == NULL){
+        return retain(node->right);
+    }
+    if (node->right == NULL){
+        return retain(node->left);
+    }
+    // replace the node with its successor; min stays alive in this version
+    const PersistentNode* min = NULL;
+    const PersistentNode* right = removeMin(node->right, min);
+    return balance(min->item, retain(node->left), right);
+}
+
+/**
+* Returns a new reference to the subtree without its smallest node, which
+* is stored in min.
+*/
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::removeMin(const PersistentNode* node, const PersistentNode*& min)
+{
+    if (node->left == NULL){
+        min = node;
+        return retain(node->right);
+    }
+    const PersistentNode* left = removeMin(node->left, min);
+    return balance(node->item, left, retain(node->right));
+}
+
+/**
+* Builds count nodes from the sorted items at it, middle item at the root.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+const typename PersistentAVLTree<Key, Value>::PersistentNode*
+PersistentAVLTree<Key, Value>::buildSubtree(ForwardIt& it, size_t count)
+{
+    if (count == 0){
+        return NULL;
+    }
+    size_t leftCount = count / 2;
+    const PersistentNode* left = buildSubtree(it, leftCount);
+    ForwardIt middle = it;
+    const PersistentNode* right;
+    try {
+        right = buildSubtree(++it, count - leftCount - 1);
+    }
+    catch (...) {
+        release(left);
+        throw;
+    }
+    return makeNode(*middle, left, right);
+}
+
+/**
+* Returns the height of the subtree, or -1 if it is out of order,
+* unbalanced or has a wrong stored height.
+*/
+template<class Key, class Value>
+int PersistentAVLTree<Key, Value>::checkHelp(const PersistentNode* node, const Key* lo, const Key* hi)
+{
+    if (node == NULL){
+        return 0;
+    }
+    const Key& key = node->item.first;
+    if ((lo != NULL && !(*lo < key)) || (hi != NULL && !(key < *hi))){
+        return -1;
+    }
+    int lh = checkHelp(node->left, lo, &key);
+    int rh = checkHelp(node->right, &key, hi);
+    if (lh < 0 || rh < 0 || lh - rh > 1 || rh - lh > 1){
+        return -1;
+    }
+    int h = 1 + (lh > rh ? lh : rh);
+    return h == node->height ? h : -1;
+}
+
+/*
+-----------------------------------------------
+End implementations for the PersistentAVLTree class.
+-----------------------------------------------
+*/
+
+#endif
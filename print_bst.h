@@ -17,8 +17,8 @@
 // 1 means that it is the root.
 // Returns -1 (not found) if the distance is more than PPBST_MAX_HEIGHT,
 // or -2 if the tree is inconsistent.
-template<typename Key, typename Value>
-int getNodeDepth(BinarySearchTree<Key, Value> const & tree, Node<Key, Value> * root, Node<Key, Value> * node)
+template<typename Key, typename Value, typename Alloc>
+int getNodeDepth(BinarySearchTree<Key, Value, Alloc> const & tree, Node<Key, Value> * root, Node<Key, Value> * node)
 {
     int dist = 1;
 
@@ -63,6 +63,21 @@ int getSubtreeHeight(Node<Key, Value> * root, int recursionDepth = 1)
                     getSubtreeHeight(root->getRight(), recursionDepth + 1)) + 1;
 }
 
+// Prints a value if it can be streamed, and "..." otherwise, so that trees
+// holding containers or move-only values still compile (printRoot is
+// virtual and therefore always instantiated).
+template<typename T>
+auto printBSTValue(std::ostream & out, T const & value, int) -> decltype(out << value, void())
+{
+    out << value;
+}
+
+template<typename T>
+void printBSTValue(std::ostream & out, T const &, long)
+{
+    out << "...";
+}
+
 /* Function to prettily print a BST out to the terminal.
 
    Output should look a bit like this:
@@ -92,8 +107,8 @@ int getSubtreeHeight(Node<Key, Value> * root, int recursionDepth = 1)
 
     */
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::printRoot (Node<Key, Value>* root) const
 {
     // special case for empty trees:
     if(root == nullptr)
@@ -130,7 +145,7 @@ void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
     std::map<Key, uint8_t> valuePlaceholders;
 
     uint8_t nextPlaceHolderVal = 1;
-    for(typename BinarySearchTree<Key, Value>::iterator treeIter = this->begin(); treeIter != this->end(); ++treeIter)
+    for(typename BinarySearchTree<Key, Value, Alloc>::iterator treeIter = this->begin(); treeIter != this->end(); ++treeIter)
     {
 
         if(getNodeDepth(*this, root, treeIter.current_) != -1)
@@ -273,14 +288,14 @@ void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
             std::cout.flags(origCoutState);
             std::cout << '(' << placeholdersIter->first << ", ";
 
-            typename BinarySearchTree<Key, Value>::iterator elementIter = this->find(placeholdersIter->first);
+            typename BinarySearchTree<Key, Value, Alloc>::iterator elementIter = this->find(placeholdersIter->first);
             if(elementIter == this->end())
             {
                 std::cout << "<error: lookup failed>";
             }
             else
             {
-                std::cout << elementIter->second;
+                printBSTValue(std::cout, elementIter->second, 0);
             }
 
             std::cout << ')' << std::endl;
@@ -0,0 +1,798 @@
+#ifndef RCU_AVL_H
+#define RCU_AVL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include "epoch-reclaim.h"
+#include "tree-stream.h"
+
+/**
+* An AVL tree for many concurrent readers and one writer at a time, in
+* the style of read-copy-update.
+*
+* Readers never lock: they pin the current version of the tree and read
+* it while writers carry on. A writer never modifies a node a reader can
+* see. insert and remove copy the nodes on the path they change
+* (including those a rotation touches), link the copies into a new
+* version, and publish it with a single atomic store of the root. Readers
+* that started earlier keep reading the old version, which stays intact.
+*
+* The replaced nodes are freed by an EpochReclaimer: each reader pins it,
+* and nodes retired by an update are freed only once every pinned reader
+* started after that update.
+*
+* Writers are serialized by a mutex, so there may be several writer
+* threads; they simply take turns. An update that throws (say, from a
+* Value copy) frees the copies it made and leaves the published version
+* as it was. The tree must not be destroyed while
+* any Snapshot is alive.
+*/
+template <typename Key, typename Value>
+class RcuAVLTree
+{
+protected:
+    struct RcuNode
+    {
+        RcuNode(const Key& key, const Value& value, uint64_t version) :
+            item(key, value), left(NULL), right(NULL), height(1), version(version)
+        {
+
+        }
+
+        std::pair<const Key, Value> item;
+        RcuNode* left;
+        RcuNode* right;
+        int height;         // leaves have height 1
+        uint64_t version;   // the update that created this node
+    };
+
+public:
+    // Deepest possible AVL tree holding 2^64 nodes.
+    static const int MAX_HEIGHT = 96;
+
+    RcuAVLTree();
+    ~RcuAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool empty() const;
+    size_t size() const;
+    bool isValidAVL() const;
+    size_t exportTo(TreeStreamWriter<Key, Value>& out,
+                    size_t pinItems = TreeStreamWriter<Key, Value>::DEFAULT_CHUNK_ITEMS) const;
+    size_t exportRange(const Key& lo, const Key& hi, TreeStreamWriter<Key, Value>& out,
+                       size_t pinItems = TreeStreamWriter<Key, Value>::DEFAULT_CHUNK_ITEMS) const;
+
+    /**
+    * One pinned version of the tree. Everything read through a snapshot
+    * stays valid, and unchanged, until the snapshot is destroyed.
+    */
+    class Snapshot
+    {
+    public:
+        class iterator
+        {
+        public:
+            iterator();
+
+            const std::pair<const Key,Value>& operator*() const;
+            const std::pair<const Key,Value>* operator->() const;
+
+            bool operator==(const iterator& rhs) const;
+            bool operator!=(const iterator& rhs) const;
+
+            iterator& operator++();
+
+        protected:
+            friend class Snapshot;
+            explicit iterator(const RcuNode* root);
+            iterator(const RcuNode* root, const Key& key, bool strict);
+            void pushLeftSpine(const RcuNode* node);
+
+            // The current node is on top; the rest are the ancestors still
+            // to be visited, so stepping needs no parent pointers.
+            const RcuNode* stack_[MAX_HEIGHT];
+            int depth_;
+        };
+
+        Snapshot(Snapshot&& other);
+        ~Snapshot();
+
+        iterator begin() const;
+        iterator end() const;
+        iterator lowerBound(const Key& key) const;
+        iterator upperBound(const Key& key) const;
+        const Value* find(const Key& key) const;
+
+    protected:
+        friend class RcuAVLTree<Key, Value>;
+        Snapshot(const RcuAVLTree<Key, Value>* tree);
+
+        const RcuAVLTree<Key, Value>* tree_;
+        size_t slot_;
+        const RcuNode* root_;
+
+    private:
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+    };
+
+    Snapshot snapshot() const;
+
+protected:
+    static const RcuNode* findNode(const RcuNode* node, const Key& key);
+    size_t exportHelp(const Key* lo, const Key* hi, TreeStreamWriter<Key, Value>& out, size_t pinItems) const;
+
+    void beginUpdate();
+    void abandonUpdate();
+    RcuNode* createNode(const Key& key, const Value& value);
+    RcuNode* own(RcuNode* node);
+    void discard(RcuNode* node);
+    static int height(const RcuNode* node);
+    static void updateHeight(RcuNode* node);
+    RcuNode* rotateLeft(RcuNode* node);
+    RcuNode* rotateRight(RcuNode* node);
+    RcuNode* rebalance(RcuNode* node);
+    RcuNode* insertHelp(RcuNode* node, const Key& key, const Value& value, bool& inserted);
+    RcuNode* removeHelp(RcuNode* node, const Key& key, bool& removed);
+    RcuNode* removeMin(RcuNode* node, RcuNode*& min);
+    void publish(RcuNode* root);
+    static void clearHelp(RcuNode* node);
+    static int checkHelp(const RcuNode* node, const Key* lo, const Key* hi);
+
+protected:
+    std::atomic<RcuNode*> root_;
+    std::atomic<size_t> size_;
+    EpochReclaimer reclaimer_;
+
+    // Writer state, guarded by writeMutex_.
+    std::mutex writeMutex_;
+    uint64_t version_;
+    std::vector<RcuNode*> retiring_;    // published nodes the update replaces
+    std::vector<RcuNode*> created_;     // nodes the update made
+
+private:
+    RcuAVLTree(const RcuAVLTree&);
+    RcuAVLTree& operator=(const RcuAVLTree&);
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the RcuAVLTree::Snapshot class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::Snapshot::iterator::iterator() :
+    depth_(0)
+{
+
+}
+
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::Snapshot::iterator::iterator(const RcuNode* root) :
+    depth_(0)
+{
+    pushLeftSpine(root);
+}
+
+/**
+* Starts at the first key not less than key, or greater than key if
+* strict. The stack keeps the nodes where the descent went left: exactly
+* the ancestors an in-order walk from there still has to visit.
+*/
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::Snapshot::iterator::iterator(const RcuNode* root, const Key& key, bool strict) :
+    depth_(0)
+{
+    for (const RcuNode* node = root; node != NULL; ){
+        if (strict ? !(key < node->item.first) : node->item.first < key){
+            node = node->right;
+        }
+        else {
+            stack_[depth_++] = node;
+            node = node->left;
+        }
+    }
+}
+
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::Snapshot::iterator::pushLeftSpine(const RcuNode* node)
+{
+    for (; node != NULL; node = node->left){
+        stack_[depth_++] = node;
+    }
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> &
+RcuAVLTree<Key, Value>::Snapshot::iterator::operator*() const
+{
+    return stack_[depth_ - 1]->item;
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> *
+RcuAVLTree<Key, Value>::Snapshot::iterator::operator->() const
+{
+    return &(stack_[depth_ - 1]->item);
+}
+
+template<class Key, class Value>
+bool RcuAVLTree<Key, Value>::Snapshot::iterator::operator==(const iterator& rhs) const
+{
+    return depth_ == rhs.depth_ && (depth_ == 0 || stack_[depth_ - 1] == rhs.stack_[depth_ - 1]);
+}
+
+template<class Key, class Value>
+bool RcuAVLTree<Key, Value>::Snapshot::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Pops the current node and descends into its right subtree, if any.
+*/
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::Snapshot::iterator&
+RcuAVLTree<Key, Value>::Snapshot::iterator::operator++()
+{
+    const RcuNode* node = stack_[--depth_];
+    pushLeftSpine(node->right);
+    return *this;
+}
+
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::Snapshot::Snapshot(const RcuAVLTree<Key, Value>* tree) :
+    tree_(tree),
+    slot_(tree->reclaimer_.pin()),
+    root_(tree->root_.load())
+{
+
+}
+
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::Snapshot::Snapshot(Snapshot&& other) :
+    tree_(other.tree_),
+    slot_(other.slot_),
+    root_(other.root_)
+{
+    other.tree_ = NULL;
+}
+
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::Snapshot::~Snapshot()
+{
+    if (tree_ != NULL){
+        tree_->reclaimer_.unpin(slot_);
+    }
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::Snapshot::iterator
+RcuAVLTree<Key, Value>::Snapshot::begin() const
+{
+    return iterator(root_);
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::Snapshot::iterator
+RcuAVLTree<Key, Value>::Snapshot::end() const
+{
+    return iterator();
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::Snapshot::iterator
+RcuAVLTree<Key, Value>::Snapshot::lowerBound(const Key& key) const
+{
+    return iterator(root_, key, false);
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::Snapshot::iterator
+RcuAVLTree<Key, Value>::Snapshot::upperBound(const Key& key) const
+{
+    return iterator(root_, key, true);
+}
+
+/**
+* Returns the key's value in this version, or NULL if it is not present.
+*/
+template<class Key, class Value>
+const Value* RcuAVLTree<Key, Value>::Snapshot::find(const Key& key) const
+{
+    const RcuNode* node = findNode(root_, key);
+    return node == NULL ? NULL : &node->item.second;
+}
+
+/*
+-----------------------------------------------
+End implementations for the RcuAVLTree::Snapshot class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the RcuAVLTree class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::RcuAVLTree() :
+    root_(NULL),
+    size_(0),
+    version_(0)
+{
+
+}
+
+/**
+* No reader may still hold a Snapshot.
+*/
+template<class Key, class Value>
+RcuAVLTree<Key, Value>::~RcuAVLTree()
+{
+    clearHelp(root_.load());
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::Snapshot
+RcuAVLTree<Key, Value>::snapshot() const
+{
+    return Snapshot(this);
+}
+
+/**
+* Copies the key's current value into value. Returns false if the key is
+* not present.
+*/
+template<class Key, class Value>
+bool RcuAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    Snapshot pinned(this);
+    const Value* found = pinned.find(key);
+    if (found == NULL){
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+template<class Key, class Value>
+bool RcuAVLTree<Key, Value>::empty() const
+{
+    return size_.load() == 0;
+}
+
+template<class Key, class Value>
+size_t RcuAVLTree<Key, Value>::size() const
+{
+    return size_.load();
+}
+
+/**
+* Checks ordering, stored heights and AVL balance of the current version.
+*/
+template<class Key, class Value>
+bool RcuAVLTree<Key, Value>::isValidAVL() const
+{
+    Snapshot pinned(this);
+    return checkHelp(pinned.root_, NULL, NULL) >= 0;
+}
+
+/**
+* Writes every item to out in key order while writers carry on, and
+* returns how many. See exportRange.
+*/
+template<class Key, class Value>
+size_t RcuAVLTree<Key, Value>::exportTo(TreeStreamWriter<Key, Value>& out, size_t pinItems) const
+{
+    return exportHelp(NULL, NULL, out, pinItems);
+}
+
+/**
+* Writes the items with lo <= key < hi to out in key order while writers
+* carry on, and returns how many; out is not finished.
+*
+* Rather than pin one version for the whole export, which would keep
+* every node replaced meanwhile from being freed, the export pins a fresh
+* version for each pinItems items and resumes after the last key written.
+* Each run of pinItems items is consistent, the export as a whole is not
+* one version: every key present and unchanged throughout is written
+* exactly once, and keys are strictly increasing, but a key updated
+* during the export may appear with either value or not at all. For a
+* point-in-time copy, iterate a single snapshot() instead.
+*/
+template<class Key, class Value>
+size_t RcuAVLTree<Key, Value>::exportRange(const Key& lo, const Key& hi, TreeStreamWriter<Key, Value>& out,
+                                           size_t pinItems) const
+{
+    return exportHelp(&lo, &hi, out, pinItems);
+}
+
+/**
+* lo and hi may be NULL for no bound.
+*/
+template<class Key, class Value>
+size_t RcuAVLTree<Key, Value>::exportHelp(const Key* lo, const Key* hi, TreeStreamWriter<Key, Value>& out,
+                                          size_t pinItems) const
+{
+    if (pinItems == 0){
+        throw std::invalid_argument("exportRange: pinItems must be positive");
+    }
+    std::vector<Key> last;  // the last key written, once there is one
+    size_t written = 0;
+    while (true){
+        Snapshot pinned(this);
+        typename Snapshot::iterator it = !last.empty() ? pinned.upperBound(last[0])
+                                       : lo != NULL ? pinned.lowerBound(*lo) : pinned.begin();
+        const Key* key = NULL;
+        size_t n = 0;
+        for (; n < pinItems && it != pinned.end() && (hi == NULL || it->first < *hi); ++it, ++n){
+            out.write(*it);
+            key = &it->first;
+        }
+        written += n;
+        if (n < pinItems){
+            return written;
+        }
+        last.assign(1, *key);
+    }
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    beginUpdate();
+    bool inserted = false;
+    RcuNode* root;
+    try {
+        root = insertHelp(root_.load(), keyValuePair.first, keyValuePair.second, inserted);
+    }
+    catch (...) {
+        abandonUpdate();
+        throw;
+    }
+    if (inserted){
+        size_.fetch_add(1);
+    }
+    publish(root);
+}
+
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    beginUpdate();
+    bool removed = false;
+    RcuNode* root;
+    try {
+        root = removeHelp(root_.load(), key, removed);
+    }
+    catch (...) {
+        abandonUpdate();
+        throw;
+    }
+    if (!removed){
+        abandonUpdate();
+        return;
+    }
+    size_.fetch_sub(1);
+    publish(root);
+}
+
+template<class Key, class Value>
+const typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::findNode(const RcuNode* node, const Key& key)
+{
+    while (node != NULL){
+        if (key < node->item.first){
+            node = node->left;
+        }
+        else if (node->item.first < key){
+            node = node->right;
+        }
+        else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Starts a new version. An update owns at most three nodes per level
+* (the path plus a double rotation) and one more level than the tree has,
+* so reserving that much up front means recording a node never throws
+* after it was allocated.
+*/
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::beginUpdate()
+{
+    ++version_;
+    size_t most = 3 * (height(root_.load()) + 1) + 1;
+    retiring_.reserve(most);
+    created_.reserve(most);
+}
+
+/**
+* Undoes an update that will not be published: frees everything it made
+* and forgets the published nodes it meant to retire, which stay live.
+*/
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::abandonUpdate()
+{
+    for (size_t i = 0; i < created_.size(); ++i){
+        delete created_[i];
+    }
+    created_.clear();
+    retiring_.clear();
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::createNode(const Key& key, const Value& value)
+{
+    RcuNode* node = new RcuNode(key, value, version_);
+    created_.push_back(node);
+    return node;
+}
+
+/**
+* Returns a node of the version being built that the writer may modify:
+* the node itself if this update created it, otherwise a copy, with the
+* published original queued for retirement.
+*/
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::own(RcuNode* node)
+{
+    if (node->version == version_){
+        return node;
+    }
+    RcuNode* copy = createNode(node->item.first, node->item.second);
+    copy->left = node->left;
+    copy->right = node->right;
+    copy->height = node->height;
+    retiring_.push_back(node);
+    return copy;
+}
+
+/**
+* Drops a node from the version being built.
+*/
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::discard(RcuNode* node)
+{
+    if (node->version == version_){
+        created_.erase(std::find(created_.begin(), created_.end(), node));
+        delete node;
+    }
+    else {
+        retiring_.push_back(node);
+    }
+}
+
+template<class Key, class Value>
+int RcuAVLTree<Key, Value>::height(const RcuNode* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::updateHeight(RcuNode* node)
+{
+    int lh = height(node->left);
+    int rh = height(node->right);
+    node->height = 1 + (lh > rh ? lh : rh);
+}
+
+/**
+* Rotates an owned node left; its right child is owned first, since the
+* rotation changes it.
+*/
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::rotateLeft(RcuNode* node)
+{
+    RcuNode* child = own(node->right);
+    node->right = child->left;
+    child->left = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::rotateRight(RcuNode* node)
+{
+    RcuNode* child = own(node->left);
+    node->left = child->right;
+    child->right = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+/**
+* Restores the AVL balance of an owned node whose subtrees differ in
+* height by at most two, and returns the subtree's new root.
+*/
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::rebalance(RcuNode* node)
+{
+    updateHeight(node);
+    int balance = height(node->right) - height(node->left);
+    if (balance < -1){
+        if (height(node->left->right) > height(node->left->left)){
+            node->left = rotateLeft(own(node->left));
+        }
+        return rotateRight(node);
+    }
+    if (balance > 1){
+        if (height(node->right->left) > height(node->right->right)){
+            node->right = rotateRight(own(node->right));
+        }
+        return rotateLeft(node);
+    }
+    return node;
+}
+
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::insertHelp(RcuNode* node, const Key& key, const Value& value, bool& inserted)
+{
+    if (node == NULL){
+        inserted = true;
+        return createNode(key, value);
+    }
+    if (key < node->item.first){
+        RcuNode* left = insertHelp(node->left, key, value, inserted);
+        node = own(node);
+        node->left = left;
+        return rebalance(node);
+    }
+    if (node->item.first < key){
+        RcuNode* right = insertHelp(node->right, key, value, inserted);
+        node = own(node);
+        node->right = right;
+        return rebalance(node);
+    }
+    node = own(node);
+    node->item.second = value;
+    return node;
+}
+
+/**
+* Removes key below node. Subtrees the key is not in are returned as they
+* are, so a miss copies nothing.
+*/
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::removeHelp(RcuNode* node, const Key& key, bool& removed)
+{
+    if (node == NULL){
+        return NULL;
+    }
+    if (key < node->item.first){
+        RcuNode* left = removeHelp(node->left, key, removed);
+        if (!removed){
+            return node;
+        }
+        node = own(node);
+        node->left = left;
+        return rebalance(node);
+    }
+    if (node->item.first < key){
+        RcuNode* right = removeHelp(node->right, key, removed);
+        if (!removed){
+            return node;
+        }
+        node = own(node);
+        node->right = right;
+        return rebalance(node);
+    }
+
+    removed = true;
+    RcuNode* left = node->left;
+    RcuNode* right = node->right;
+    discard(node);
+    if (left == NULL){
+        return right;
+    }
+    if (right == NULL){
+        return left;
+    }
+    // replace the node with its successor
+    RcuNode* successor = NULL;
+    right = removeMin(right, successor);
+    successor = own(successor);
+    successor->left = left;
+    successor->right = right;
+    return rebalance(successor);
+}
+
+/**
+* Unlinks the smallest node below node into min and returns the rest.
+*/
+template<class Key, class Value>
+typename RcuAVLTree<Key, Value>::RcuNode*
+RcuAVLTree<Key, Value>::removeMin(RcuNode* node, RcuNode*& min)
+{
+    if (node->left == NULL){
+        min = node;
+        return node->right;
+    }
+    RcuNode* left = removeMin(node->left, min);
+    node = own(node);
+    node->left = left;
+    return rebalance(node);
+}
+
+/**
+* Makes the new version visible, then hands the nodes it replaced to the
+* reclaimer, which advances the epoch after the root store: a reader that
+* announces the new epoch can only ever see the new version.
+*/
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::publish(RcuNode* root)
+{
+    root_.store(root);
+    created_.clear();
+    reclaimer_.retire(retiring_);
+}
+
+template<class Key, class Value>
+void RcuAVLTree<Key, Value>::clearHelp(RcuNode* node)
+{
+    if (node == NULL){
+        return;
+    }
+    clearHelp(node->left);
+    clearHelp(node->right);
+    delete node;
+}
+
+/**
+* Returns the height of the subtree, or -1 if it is out of order,
+* unbalanced or has a wrong stored height.
+*/
+template<class Key, class Value>
+int RcuAVLTree<Key, Value>::checkHelp(const RcuNode* node, const Key* lo, const Key* hi)
+{
+    if (node == NULL){
+        return 0;
+    }
+    const Key& key = node->item.first;
+    if ((lo != NULL && !(*lo < key)) || (hi != NULL && !(key < *hi))){
+        return -1;
+    }
+    int lh = checkHelp(node->left, lo, &key);
+    int rh = checkHelp(node->right, &key, hi);
+    if (lh < 0 || rh < 0 || lh - rh > 1 || rh - lh > 1){
+        return -1;
+    }
+    int h = 1 + (lh > rh ? lh : rh);
+    return h == node->height ? h : -1;
+}
+
+/*
+-----------------------------------------------
+End implementations for the RcuAVLTree class.
+-----------------------------------------------
+*/
+
+#endif
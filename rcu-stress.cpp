@@ -0,0 +1,243 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <map>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include "rcu-avl.h"
+
+using namespace std;
+
+/*
+ * Stress test for RcuAVLTree: one writer inserts and removes random keys
+ * while reader threads look keys up, scan whole snapshots and export key
+ * ranges.
+ *
+ *   rcu-stress [readers] [updates]     (default: 8 readers, 200000 updates)
+ *
+ * Every value encodes its key, so a reader can tell a torn or freed node
+ * from a good one. Each snapshot must list strictly increasing keys, and
+ * a snapshot taken after the writer stops must be a valid AVL tree that
+ * matches the writer's own record of the contents. Build it with
+ * -fsanitize=thread or -fsanitize=address to also catch races and
+ * use-after-free in the reclamation.
+ *
+ * Before the readers start, a second tree holds values whose copies throw
+ * on demand, to check that a failed update frees its copies and leaves
+ * both the published version and older snapshots intact.
+ */
+
+static const uint64_t KEY_RANGE = 4096;
+
+static uint64_t valueFor(uint64_t key, uint64_t generation)
+{
+    return (key << 32) | (generation & 0xffffffff);
+}
+
+static atomic<bool> stop(false);
+static atomic<size_t> failures(0);
+
+static void fail(const char* what)
+{
+    if(failures.fetch_add(1) < 10) {
+        cerr << "FAIL: " << what << endl;
+    }
+}
+
+static void reader(const RcuAVLTree<uint64_t, uint64_t>* tree, unsigned seed, size_t* reads)
+{
+    mt19937_64 gen(seed);
+    size_t count = 0;
+    while(!stop.load()) {
+        for(int i = 0; i < 64; i++) {
+            uint64_t key = gen() % KEY_RANGE;
+            uint64_t value = 0;
+            if(tree->find(key, value) && (value >> 32) != key) {
+                fail("find returned another key's value");
+            }
+            ++count;
+        }
+
+        RcuAVLTree<uint64_t, uint64_t>::Snapshot snap = tree->snapshot();
+        bool first = true;
+        uint64_t previous = 0;
+        for(RcuAVLTree<uint64_t, uint64_t>::Snapshot::iterator it = snap.begin(); it != snap.end(); ++it) {
+            if(!first && it->first <= previous) {
+                fail("snapshot keys out of order");
+            }
+            if((it->second >> 32) != it->first) {
+                fail("snapshot value does not match its key");
+            }
+            first = false;
+            previous = it->first;
+        }
+
+        // A chunked export re-pins every few items while the writer runs.
+        uint64_t lo = gen() % KEY_RANGE;
+        stringstream stream;
+        TreeStreamWriter<uint64_t, uint64_t> writer(stream, true);
+        tree->exportRange(lo, lo + KEY_RANGE / 4, writer, 16);
+        writer.finish();
+        TreeStreamReader<uint64_t, uint64_t> streamReader(stream);
+        vector<pair<uint64_t, uint64_t> > items;
+        streamReader.read(items, KEY_RANGE);
+        for(size_t i = 0; i < items.size(); i++) {
+            if(items[i].first < lo || items[i].first >= lo + KEY_RANGE / 4
+                    || (i > 0 && items[i].first <= items[i - 1].first)) {
+                fail("exported keys out of order or range");
+            }
+            if((items[i].second >> 32) != items[i].first) {
+                fail("exported value does not match its key");
+            }
+        }
+    }
+    *reads = count;
+}
+
+// A value whose copy throws once copiesLeft runs out (when armed).
+struct FlakyValue
+{
+    static int copiesLeft;
+
+    explicit FlakyValue(uint64_t v) : v(v) {}
+    FlakyValue(const FlakyValue& other) : v(other.v) { countCopy(); }
+    FlakyValue& operator=(const FlakyValue& other) { countCopy(); v = other.v; return *this; }
+
+    static void countCopy()
+    {
+        if(copiesLeft >= 0 && copiesLeft-- == 0) {
+            throw runtime_error("copy failed");
+        }
+    }
+
+    uint64_t v;
+};
+
+int FlakyValue::copiesLeft = -1;
+
+static size_t countItems(const RcuAVLTree<uint64_t, FlakyValue>::Snapshot& snap)
+{
+    size_t n = 0;
+    for(RcuAVLTree<uint64_t, FlakyValue>::Snapshot::iterator it = snap.begin(); it != snap.end(); ++it) {
+        ++n;
+    }
+    return n;
+}
+
+static void checkFailedUpdates()
+{
+    RcuAVLTree<uint64_t, FlakyValue> tree;
+    map<uint64_t, uint64_t> expected;
+    mt19937_64 gen(7);
+    for(uint64_t key = 0; key < 512; key++) {
+        tree.insert(make_pair(key * 2, FlakyValue(key)));
+        expected[key * 2] = key;
+    }
+
+    size_t thrown = 0;
+    for(size_t i = 0; i < 5000; i++) {
+        RcuAVLTree<uint64_t, FlakyValue>::Snapshot before = tree.snapshot();
+        size_t count = countItems(before);
+        uint64_t key = gen() % 1200;
+        bool remove = gen() % 3 == 0;
+        FlakyValue value(gen() % 1000);
+        FlakyValue::copiesLeft = int(gen() % 12);
+        try {
+            if(remove) {
+                tree.remove(key);
+                expected.erase(key);
+            }
+            else {
+                tree.insert(make_pair(key, value));
+                expected[key] = value.v;
+            }
+        }
+        catch(const runtime_error&) {
+            ++thrown;
+        }
+        FlakyValue::copiesLeft = -1;
+
+        // the version pinned before the update must be untouched
+        if(countItems(before) != count) {
+            fail("snapshot changed across an update");
+        }
+    }
+
+    if(!tree.isValidAVL() || tree.size() != expected.size()) {
+        fail("tree damaged by failed updates");
+    }
+    RcuAVLTree<uint64_t, FlakyValue>::Snapshot after = tree.snapshot();
+    map<uint64_t, uint64_t>::const_iterator want = expected.begin();
+    for(RcuAVLTree<uint64_t, FlakyValue>::Snapshot::iterator it = after.begin(); it != after.end(); ++it, ++want) {
+        if(want == expected.end() || it->first != want->first || it->second.v != want->second) {
+            fail("contents differ after failed updates");
+            break;
+        }
+    }
+    cout << thrown << " of 5000 updates threw; tree unchanged by them" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    checkFailedUpdates();
+
+    size_t readers = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+    size_t updates = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+
+    RcuAVLTree<uint64_t, uint64_t> tree;
+    vector<uint64_t> expected(KEY_RANGE, 0);   // 0: absent, else the value
+    vector<size_t> reads(readers, 0);
+    vector<thread> threads;
+    for(size_t i = 0; i < readers; i++) {
+        threads.push_back(thread(reader, &tree, unsigned(i + 1), &reads[i]));
+    }
+
+    mt19937_64 gen(42);
+    for(size_t i = 0; i < updates; i++) {
+        uint64_t key = gen() % KEY_RANGE;
+        if(gen() % 3 == 0) {
+            tree.remove(key);
+            expected[key] = 0;
+        }
+        else {
+            uint64_t value = valueFor(key, i + 1);
+            tree.insert(make_pair(key, value));
+            expected[key] = value;
+        }
+    }
+    stop.store(true);
+    size_t totalReads = 0;
+    for(size_t i = 0; i < readers; i++) {
+        threads[i].join();
+        totalReads += reads[i];
+    }
+
+    if(!tree.isValidAVL()) {
+        fail("final tree is not a valid AVL tree");
+    }
+    size_t present = 0;
+    for(uint64_t key = 0; key < KEY_RANGE; key++) {
+        uint64_t value = 0;
+        bool found = tree.find(key, value);
+        if(found != (expected[key] != 0) || (found && value != expected[key])) {
+            fail("final contents differ from the writer's record");
+        }
+        present += found;
+    }
+    if(present != tree.size()) {
+        fail("size() differs from the number of keys");
+    }
+
+    cout << updates << " updates, " << totalReads << " lookups by " << readers << " readers, "
+         << tree.size() << " keys left" << endl;
+    if(failures.load() != 0) {
+        cout << failures.load() << " failures" << endl;
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
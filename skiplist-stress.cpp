@@ -0,0 +1,151 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstdlib>
+#include <cstdint>
+#include "concurrent-skiplist.h"
+
+using namespace std;
+
+/*
+ * Stress test for ConcurrentSkipList: every thread inserts, removes and
+ * looks up keys at the same time, and one of them also walks the whole
+ * list with forEach.
+ *
+ *   skiplist-stress [threads] [operations]   (default: 8 threads, 200000 each)
+ *
+ * Each thread owns the keys congruent to its index, so it alone updates
+ * them and keeps an exact record of their values; a small range of shared
+ * keys is updated by all threads at once to contend for the same nodes.
+ * Every value encodes its key, so a torn or freed node shows up in any
+ * lookup. Once all threads stop, the list must be well formed and match
+ * the records. Build it with -fsanitize=thread or -fsanitize=address to
+ * also catch races and use-after-free in the reclamation.
+ */
+
+typedef ConcurrentSkipList<uint64_t, uint64_t> SkipList;
+
+static const uint64_t OWNED_KEYS = 4096;
+static const uint64_t SHARED_KEYS = 64;
+
+static uint64_t valueFor(uint64_t key, uint64_t generation)
+{
+    return (key << 32) | (generation & 0xffffffff);
+}
+
+static atomic<size_t> failures(0);
+
+static void fail(const char* what)
+{
+    if(failures.fetch_add(1) < 10) {
+        cerr << "FAIL: " << what << endl;
+    }
+}
+
+static void worker(SkipList* list, size_t index, size_t threads, size_t operations,
+                   vector<uint64_t>* expected)
+{
+    mt19937_64 gen(index + 1);
+    for(size_t i = 0; i < operations; i++) {
+        uint64_t choice = gen() % 8;
+        uint64_t key;
+        if(choice == 0) {
+            key = OWNED_KEYS + gen() % SHARED_KEYS;
+        }
+        else {
+            key = (gen() % (OWNED_KEYS / threads)) * threads + index;
+        }
+        bool owned = key < OWNED_KEYS;
+
+        uint64_t op = gen() % 4;
+        if(op == 0) {
+            list->remove(key);
+            if(owned) {
+                (*expected)[key] = 0;
+            }
+        }
+        else if(op == 1) {
+            uint64_t value = valueFor(key, i + 1);
+            list->insert(make_pair(key, value));
+            if(owned) {
+                (*expected)[key] = value;
+            }
+        }
+        else {
+            uint64_t probe = gen() % (OWNED_KEYS + SHARED_KEYS);
+            uint64_t value = 0;
+            bool found = list->find(probe, value);
+            if(found && (value >> 32) != probe) {
+                fail("find returned another key's value");
+            }
+            if(probe == key && owned && found != ((*expected)[key] != 0)) {
+                fail("find disagrees with the owner's record");
+            }
+        }
+
+        if(index == 0 && i % 4096 == 0) {
+            bool first = true;
+            uint64_t previous = 0;
+            list->forEach([&first, &previous](const pair<const uint64_t, uint64_t>& item) {
+                if(!first && item.first <= previous) {
+                    fail("forEach keys out of order");
+                }
+                if((item.second >> 32) != item.first) {
+                    fail("forEach value does not match its key");
+                }
+                first = false;
+                previous = item.first;
+            });
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+    size_t operations = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+    if(threads == 0 || threads > OWNED_KEYS) {
+        cerr << "threads must be between 1 and " << OWNED_KEYS << endl;
+        return 1;
+    }
+
+    SkipList list;
+    vector<uint64_t> expected(OWNED_KEYS, 0);   // 0: absent, else the value
+    vector<thread> workers;
+    for(size_t i = 0; i < threads; i++) {
+        workers.push_back(thread(worker, &list, i, threads, operations, &expected));
+    }
+    for(size_t i = 0; i < threads; i++) {
+        workers[i].join();
+    }
+
+    if(!list.isValidSkipList()) {
+        fail("final list is not a valid skip list");
+    }
+    size_t present = 0;
+    for(uint64_t key = 0; key < OWNED_KEYS + SHARED_KEYS; key++) {
+        uint64_t value = 0;
+        bool found = list.find(key, value);
+        if(key < OWNED_KEYS && (found != (expected[key] != 0) || (found && value != expected[key]))) {
+            fail("final contents differ from the owners' records");
+        }
+        if(found && (value >> 32) != key) {
+            fail("final value does not match its key");
+        }
+        present += found;
+    }
+    if(present != list.size()) {
+        fail("size() differs from the number of keys");
+    }
+
+    cout << threads << " threads x " << operations << " operations, "
+         << list.size() << " keys left" << endl;
+    if(failures.load() != 0) {
+        cout << failures.load() << " failures" << endl;
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
@@ -0,0 +1,183 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <cstdlib>
+
+/**
+* A fixed set of worker threads for fork-join recursion.
+*
+* parallelInvoke(left, right) queues left for the workers, runs right on
+* the calling thread, and returns once both have finished. A caller whose
+* forked half is not done yet runs queued tasks itself rather than block,
+* so nested parallelInvoke calls from inside tasks cannot starve the pool
+* even when every worker is waiting on a child. Callers take the newest
+* task, usually the one they just queued; idle workers take the oldest,
+* which in a recursion is the largest.
+*
+* A pool with no workers runs both halves on the calling thread.
+*/
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    size_t size() const;
+
+    template<typename Left, typename Right>
+    void parallelInvoke(Left left, Right right);
+
+protected:
+    struct Task
+    {
+        std::function<void()> run;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    bool runNewest();
+    static void execute(Task* task);
+    void workerLoop();
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Task*> queue_;
+    bool stopping_;
+    std::vector<std::thread> workers_;
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+/**
+* Starts threads workers; 0 (e.g. when hardware_concurrency is unknown)
+* makes every parallelInvoke sequential.
+*/
+inline ThreadPool::ThreadPool(size_t threads) :
+    stopping_(false)
+{
+    for (size_t i = 0; i < threads; ++i){
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+/**
+* Waits for the workers to finish. No parallelInvoke may be running.
+*/
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i){
+        workers_[i].join();
+    }
+}
+
+inline size_t ThreadPool::size() const
+{
+    return workers_.size();
+}
+
+/**
+* Runs left and right, possibly in parallel, and rethrows the first
+* exception either of them threw once both are done.
+*/
+template<typename Left, typename Right>
+void ThreadPool::parallelInvoke(Left left, Right right)
+{
+    if (workers_.empty()){
+        left();
+        right();
+        return;
+    }
+
+    Task task;
+    task.run = left;
+    task.done.store(false);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(&task);
+    }
+    ready_.notify_one();
+
+    std::exception_ptr error;
+    try {
+        right();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    while (!task.done.load(std::memory_order_acquire)){
+        if (!runNewest()){
+            std::this_thread::yield();
+        }
+    }
+    if (task.error){
+        std::rethrow_exception(task.error);
+    }
+    if (error){
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+* Runs the newest queued task, if there is any.
+*/
+inline bool ThreadPool::runNewest()
+{
+    Task* task;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()){
+            return false;
+        }
+        task = queue_.back();
+        queue_.pop_back();
+    }
+    execute(task);
+    return true;
+}
+
+inline void ThreadPool::execute(Task* task)
+{
+    try {
+        task->run();
+    }
+    catch (...) {
+        task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+inline void ThreadPool::workerLoop()
+{
+    while (true){
+        Task* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (queue_.empty() && !stopping_){
+                ready_.wait(lock);
+            }
+            if (queue_.empty()){
+                return;
+            }
+            task = queue_.front();
+            queue_.pop_front();
+        }
+        execute(task);
+    }
+}
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef TREE_FILE_H
+#define TREE_FILE_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+* The fixed 64-byte header at the start of a tree file.
+*
+* A file holds count items in ascending key order, stored as two columns:
+* the keys from offset 64, then the values from the next multiple of 64.
+* The end is zero-padded to a multiple of 8 bytes. keyChecksum covers
+* the bytes from the end of the header to the values, valueChecksum the
+* rest of the file (see treeFileChecksum). Sizes and byte
+* order are recorded so a file is never read back as the wrong types or
+* on a machine with the other endianness.
+*/
+struct TreeFileHeader
+{
+    char magic[8];          // TREE_FILE_MAGIC
+    uint32_t version;       // TREE_FILE_VERSION
+    uint32_t byteOrder;     // TREE_FILE_BYTE_ORDER as the writer stored it
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+    uint64_t keyChecksum;
+    uint64_t valueChecksum;
+    char reserved[16];      // zero
+};
+static_assert(sizeof(TreeFileHeader) == 64, "TreeFileHeader must stay 64 bytes");
+
+static const char TREE_FILE_MAGIC[8] = { 'B', 'S', 'T', 'F', 'I', 'L', 'E', '\0' };
+static const uint32_t TREE_FILE_VERSION = 1;
+static const uint32_t TREE_FILE_BYTE_ORDER = 0x01020304;
+static const size_t TREE_FILE_ALIGN = 64;
+
+/**
+* Folds the 8-byte words at data (size must be a multiple of 8) into
+* hash. Catches torn writes and bit rot; it is not cryptographic.
+*/
+inline uint64_t treeFileChecksum(uint64_t hash, const char* data, size_t size)
+{
+    for (size_t i = 0; i < size; i += 8){
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+/**
+* A read-only view of a tree file, mapped into memory.
+*
+* Opening the file checks the header, the checksum and the key order, so
+* a TreeFile that was constructed can be trusted. keys() and values()
+* then point straight into the mapping: nothing is copied until the items
+* are turned into tree nodes, and the kernel pages the file in as they
+* are read. Key and Value must be trivially copyable.
+*
+* write() produces the files, from items in ascending key order, in one
+* pass over the items that fills both columns at once. It writes a temporary file next to path and renames it into place once
+* everything is on disk, so a crash never leaves a partial file at path.
+*/
+template <typename Key, typename Value>
+class TreeFile
+{
+public:
+    explicit TreeFile(const std::string& path);
+    ~TreeFile();
+
+    size_t size() const;
+    const Key* keys() const;
+    const Value* values() const;
+
+    template<typename ForwardIt>
+    static void write(const std::string& path, ForwardIt first, ForwardIt last, size_t count);
+
+protected:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "TreeFile stores keys and values as raw bytes; both must be trivially copyable");
+
+    static size_t roundUp(size_t offset, size_t align);
+    static size_t valuesOffset(size_t count);
+    static size_t fileSize(size_t count);
+    static void fail(const std::string& path, const char* what);
+
+    /**
+    * Writes one region of a file, from offset on, through a fixed buffer,
+    * checksumming each full buffer as it goes out.
+    */
+    class Writer
+    {
+    public:
+        Writer(int fd, const std::string& path, size_t offset);
+        void append(const void* data, size_t size);
+        void padTo(size_t offset);
+        uint64_t finish();
+
+    protected:
+        void flush();
+
+        static const size_t BUFFER_SIZE = 1 << 16;
+        int fd_;
+        const std::string& path_;
+        std::vector<char> buffer_;
+        size_t used_;
+        size_t offset_;
+        uint64_t checksum_;
+    };
+
+    void* map_;
+    size_t mapSize_;
+    size_t count_;
+
+private:
+    TreeFile(const TreeFile&);
+    TreeFile& operator=(const TreeFile&);
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the TreeFile::Writer class.
+-----------------------------------------------
+*/
+
+template<class Key, class Value>
+TreeFile<Key, Value>::Writer::Writer(int fd, const std::string& path, size_t offset) :
+    fd_(fd),
+    path_(path),
+    buffer_(BUFFER_SIZE),
+    used_(0),
+    offset_(offset),
+    checksum_(0)
+{
+
+}
+
+template<class Key, class Value>
+void TreeFile<Key, Value>::Writer::append(const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0){
+        size_t chunk = std::min(size, BUFFER_SIZE - used_);
+        std::memcpy(&buffer_[used_], bytes, chunk);
+        used_ += chunk;
+        offset_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+        if (used_ == BUFFER_SIZE){
+            flush();
+        }
+    }
+}
+
+/**
+* Appends zero bytes up to the file offset given.
+*/
+template<class Key, class Value>
+void TreeFile<Key, Value>::Writer::padTo(size_t offset)
+{
+    static const char zeros[TREE_FILE_ALIGN] = { 0 };
+    while (offset_ < offset){
+        append(zeros, std::min(offset - offset_, TREE_FILE_ALIGN));
+    }
+}
+
+/**
+* Writes out what is left and returns the checksum of the region, which
+* must end on a multiple of 8 bytes.
+*/
+template<class Key, class Value>
+uint64_t TreeFile<Key, Value>::Writer::finish()
+{
+    flush();
+    return checksum_;
+}
+
+template<class Key, class Value>
+void TreeFile<Key, Value>::Writer::flush()
+{
+    checksum_ = treeFileChecksum(checksum_, buffer_.data(), used_);
+    size_t start = offset_ - used_;
+    for (size_t done = 0; done < used_; ){
+        ssize_t n = ::pwrite(fd_, &buffer_[done], used_ - done, start + done);
+        if (n < 0 && errno != EINTR){
+            fail(path_, "write failed");
+        }
+        done += n < 0 ? 0 : n;
+    }
+    used_ = 0;
+}
+
+/*
+-----------------------------------------------
+End implementations for the TreeFile::Writer class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the TreeFile class.
+-----------------------------------------------
+*/
+
+/**
+* Maps the file at path and validates it. Throws std::runtime_error if it
+* cannot be read, is not a tree file of these key and value types, or is
+* damaged.
+*/
+template<class Key, class Value>
+TreeFile<Key, Value>::TreeFile(const std::string& path) :
+    map_(NULL),
+    mapSize_(0),
+    count_(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        fail(path, "cannot open");
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(TreeFileHeader)){
+        ::close(fd);
+        fail(path, "not a tree file");
+    }
+    mapSize_ = info.st_size;
+    map_ = ::mmap(NULL, mapSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map_ == MAP_FAILED){
+        map_ = NULL;
+        fail(path, "cannot map");
+    }
+
+    try {
+        const char* base = static_cast<const char*>(map_);
+        TreeFileHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, TREE_FILE_MAGIC, sizeof(header.magic)) != 0){
+            fail(path, "not a tree file");
+        }
+        if (header.version != TREE_FILE_VERSION){
+            fail(path, "unsupported version");
+        }
+        if (header.byteOrder != TREE_FILE_BYTE_ORDER){
+            fail(path, "written with another byte order");
+        }
+        if (header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)){
+            fail(path, "key or value size does not match");
+        }
+        // compare before computing fileSize so a huge count cannot overflow it
+        if (header.count > mapSize_ || fileSize(header.count) != mapSize_){
+            fail(path, "truncated or wrong size");
+        }
+        count_ = header.count;
+
+        ::madvise(map_, mapSize_, MADV_SEQUENTIAL);
+        size_t values = valuesOffset(count_);
+        if (treeFileChecksum(0, base + sizeof(header), values - sizeof(header)) != header.keyChecksum
+                || treeFileChecksum(0, base + values, mapSize_ - values) != header.valueChecksum){
+            fail(path, "checksum mismatch");
+        }
+        const Key* k = keys();
+        for (size_t i = 1; i < count_; ++i){
+            if (!(k[i - 1] < k[i])){
+                fail(path, "keys are not in ascending order");
+            }
+        }
+    }
+    catch (...) {
+        ::munmap(map_, mapSize_);
+        throw;
+    }
+}
+
+template<class Key, class Value>
+TreeFile<Key, Value>::~TreeFile()
+{
+    ::munmap(map_, mapSize_);
+}
+
+template<class Key, class Value>
+size_t TreeFile<Key, Value>::size() const
+{
+    return count_;
+}
+
+/**
+* The keys, in ascending order. The mapping is page aligned and the keys
+* start at offset 64, so they can be read in place.
+*/
+template<class Key, class Value>
+const Key* TreeFile<Key, Value>::keys() const
+{
+    return reinterpret_cast<const Key*>(static_cast<const char*>(map_) + sizeof(TreeFileHeader));
+}
+
+/**
+* The values, values()[i] belonging to keys()[i].
+*/
+template<class Key, class Value>
+const Value* TreeFile<Key, Value>::values() const
+{
+    return reinterpret_cast<const Value*>(static_cast<const char*>(map_) + valuesOffset(count_));
+}
+
+/**
+* Writes the count items in [first, last), in strictly ascending key
+* order, to a tree file at path, replacing any file there. Throws
+* std::runtime_error on I/O errors, leaving path untouched.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+void TreeFile<Key, Value>::write(const std::string& path, ForwardIt first, ForwardIt last, size_t count)
+{
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        fail(temp, "cannot create");
+    }
+    try {
+        Writer keys(fd, temp, sizeof(TreeFileHeader));
+        Writer values(fd, temp, valuesOffset(count));
+        for (ForwardIt it = first; it != last; ++it){
+            keys.append(&it->first, sizeof(Key));
+            values.append(&it->second, sizeof(Value));
+        }
+        keys.padTo(valuesOffset(count));
+        values.padTo(fileSize(count));
+
+        TreeFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, TREE_FILE_MAGIC, sizeof(header.magic));
+        header.version = TREE_FILE_VERSION;
+        header.byteOrder = TREE_FILE_BYTE_ORDER;
+        header.keySize = sizeof(Key);
+        header.valueSize = sizeof(Value);
+        header.count = count;
+        header.keyChecksum = keys.finish();
+        header.valueChecksum = values.finish();
+        if (::pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))){
+            fail(temp, "write failed");
+        }
+        if (::fsync(fd) != 0){
+            fail(temp, "sync failed");
+        }
+    }
+    catch (...) {
+        ::close(fd);
+        ::unlink(temp.c_str());
+        throw;
+    }
+    if (::close(fd) != 0 || std::rename(temp.c_str(), path.c_str()) != 0){
+        ::unlink(temp.c_str());
+        fail(path, "cannot replace");
+    }
+}
+
+template<class Key, class Value>
+size_t TreeFile<Key, Value>::roundUp(size_t offset, size_t align)
+{
+    return (offset + align - 1) / align * align;
+}
+
+template<class Key, class Value>
+size_t TreeFile<Key, Value>::valuesOffset(size_t count)
+{
+    return roundUp(sizeof(TreeFileHeader) + count * sizeof(Key), TREE_FILE_ALIGN);
+}
+
+template<class Key, class Value>
+size_t TreeFile<Key, Value>::fileSize(size_t count)
+{
+    return roundUp(valuesOffset(count) + count * sizeof(Value), 8);
+}
+
+template<class Key, class Value>
+void TreeFile<Key, Value>::fail(const std::string& path, const char* what)
+{
+    throw std::runtime_error(path + ": " + what);
+}
+
+/*
+-----------------------------------------------
+End implementations for the TreeFile class.
+-----------------------------------------------
+*/
+
+#endif
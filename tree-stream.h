@@ -0,0 +1,471 @@
+#ifndef TREE_STREAM_H
+#define TREE_STREAM_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include "tree-file.h"
+
+/**
+* Header at the start of a tree stream.
+*
+* A stream is a sequence of chunks, each holding up to chunkItems items
+* and ending with an empty chunk. The items are not required to be in key
+* order. Each chunk is independent: a TreeStreamChunk header, then the
+* keys column and the values column, zero-padded to a multiple of 8
+* bytes. Without TREE_STREAM_COMPRESSED the columns hold the raw bytes.
+* With it, integral keys are stored as varint deltas from the previous
+* key of the chunk and integral values as zigzag varints; other types
+* stay raw.
+*/
+struct TreeStreamHeader
+{
+    char magic[8];          // TREE_STREAM_MAGIC
+    uint32_t version;       // TREE_STREAM_VERSION
+    uint32_t byteOrder;     // TREE_FILE_BYTE_ORDER as the writer stored it
+    uint32_t flags;         // TREE_STREAM_COMPRESSED
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t reserved;      // zero
+};
+static_assert(sizeof(TreeStreamHeader) == 32, "TreeStreamHeader must stay 32 bytes");
+
+struct TreeStreamChunk
+{
+    uint32_t count;         // items in the chunk; 0 ends the stream
+    uint32_t bytes;         // payload size, a multiple of 8
+    uint64_t checksum;      // treeFileChecksum of the payload
+};
+
+static const char TREE_STREAM_MAGIC[8] = { 'B', 'S', 'T', 'S', 'T', 'R', 'M', '\0' };
+static const uint32_t TREE_STREAM_VERSION = 1;
+static const uint32_t TREE_STREAM_COMPRESSED = 1;
+
+/**
+* Encodes and decodes one column of a chunk. Integral types are varints
+* when compressed (keys as deltas, values zigzagged); anything else, or
+* an uncompressed column, is copied as raw bytes.
+*/
+template <typename T, bool Integral = std::is_integral<T>::value>
+struct TreeStreamColumn
+{
+    static void encode(const T* items, size_t count, bool compress, bool delta, std::vector<char>& out);
+    static const char* decode(const char* in, const char* end, T* items, size_t count, bool compress, bool delta);
+};
+
+/**
+* Buffers items and writes them to an ostream as a tree stream, one chunk
+* at a time, so it never holds more than chunkItems items. Call finish()
+* after the last item; a stream without its end marker reads as
+* truncated. Key and Value must be trivially copyable. Throws
+* std::runtime_error if the ostream fails.
+*/
+template <typename Key, typename Value>
+class TreeStreamWriter
+{
+public:
+    static const size_t DEFAULT_CHUNK_ITEMS = 4096;
+    static const size_t MAX_CHUNK_ITEMS = 1 << 20;
+
+    explicit TreeStreamWriter(std::ostream& out, bool compress = false,
+                              size_t chunkItems = DEFAULT_CHUNK_ITEMS);
+
+    void write(const Key& key, const Value& value);
+    void write(const std::pair<const Key, Value>& item);
+    void flush();
+    void finish();
+    size_t count() const;
+
+protected:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree streams store keys and values as raw bytes; both must be trivially copyable");
+
+    std::ostream& out_;
+    bool compress_;
+    size_t chunkItems_;
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+    std::vector<char> payload_;
+    size_t count_;
+    bool finished_;
+
+private:
+    TreeStreamWriter(const TreeStreamWriter&);
+    TreeStreamWriter& operator=(const TreeStreamWriter&);
+};
+
+/**
+* Reads a tree stream from an istream in batches of a caller-chosen size,
+* decoding one chunk at a time, so a stream of any length is read in
+* bounded memory. Throws std::runtime_error if the stream is not a tree
+* stream of these key and value types, is damaged or ends early.
+*/
+template <typename Key, typename Value>
+class TreeStreamReader
+{
+public:
+    static const size_t DEFAULT_BATCH_ITEMS = 1 << 16;
+
+    explicit TreeStreamReader(std::istream& in);
+
+    size_t read(std::vector<std::pair<Key, Value> >& batch, size_t maxItems = DEFAULT_BATCH_ITEMS);
+    bool done() const;
+
+protected:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree streams store keys and values as raw bytes; both must be trivially copyable");
+
+    void readChunk();
+    void readBytes(void* data, size_t size);
+
+    std::istream& in_;
+    bool compress_;
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+    std::vector<char> payload_;
+    size_t next_;           // first unread item of the current chunk
+    bool done_;
+
+private:
+    TreeStreamReader(const TreeStreamReader&);
+    TreeStreamReader& operator=(const TreeStreamReader&);
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the TreeStreamColumn class.
+-----------------------------------------------
+*/
+
+template<typename T, bool Integral>
+void TreeStreamColumn<T, Integral>::encode(const T* items, size_t count, bool, bool, std::vector<char>& out)
+{
+    const char* bytes = reinterpret_cast<const char*>(items);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template<typename T, bool Integral>
+const char* TreeStreamColumn<T, Integral>::decode(const char* in, const char* end, T* items, size_t count,
+                                                  bool, bool)
+{
+    if (static_cast<size_t>(end - in) < count * sizeof(T)){
+        return NULL;
+    }
+    std::memcpy(static_cast<void*>(items), in, count * sizeof(T));
+    return in + count * sizeof(T);
+}
+
+/**
+* Integral columns: raw, or 7 bits per byte with the high bit marking
+* that more bytes follow. The arithmetic is on uint64_t, where deltas of
+* unsorted keys simply wrap around.
+*/
+template<typename T>
+struct TreeStreamColumn<T, true>
+{
+    static void encode(const T* items, size_t count, bool compress, bool delta, std::vector<char>& out)
+    {
+        if (!compress){
+            TreeStreamColumn<T, false>::encode(items, count, compress, delta, out);
+            return;
+        }
+        uint64_t previous = 0;
+        for (size_t i = 0; i < count; ++i){
+            uint64_t bits = static_cast<uint64_t>(items[i]);
+            uint64_t word;
+            if (delta){
+                word = bits - previous;
+            }
+            else if (std::is_signed<T>::value){
+                word = (bits << 1) ^ (0 - (bits >> 63));
+            }
+            else {
+                word = bits;
+            }
+            previous = bits;
+            while (word >= 0x80){
+                out.push_back(static_cast<char>(word | 0x80));
+                word >>= 7;
+            }
+            out.push_back(static_cast<char>(word));
+        }
+    }
+
+    static const char* decode(const char* in, const char* end, T* items, size_t count, bool compress, bool delta)
+    {
+        if (!compress){
+            return TreeStreamColumn<T, false>::decode(in, end, items, count, compress, delta);
+        }
+        uint64_t previous = 0;
+        for (size_t i = 0; i < count; ++i){
+            uint64_t word = 0;
+            for (int shift = 0; ; shift += 7){
+                if (in == end || shift > 63){
+                    return NULL;
+                }
+                uint8_t byte = static_cast<uint8_t>(*in++);
+                word |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (byte < 0x80){
+                    break;
+                }
+            }
+            uint64_t bits;
+            if (delta){
+                bits = previous + word;
+            }
+            else if (std::is_signed<T>::value){
+                bits = (word >> 1) ^ (0 - (word & 1));
+            }
+            else {
+                bits = word;
+            }
+            previous = bits;
+            items[i] = static_cast<T>(bits);
+        }
+        return in;
+    }
+};
+
+/*
+-----------------------------------------------
+End implementations for the TreeStreamColumn class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the TreeStreamWriter class.
+-----------------------------------------------
+*/
+
+/**
+* Writes the stream header straight away. Throws std::invalid_argument if
+* chunkItems is 0 or above MAX_CHUNK_ITEMS.
+*/
+template<class Key, class Value>
+TreeStreamWriter<Key, Value>::TreeStreamWriter(std::ostream& out, bool compress, size_t chunkItems) :
+    out_(out),
+    compress_(compress),
+    chunkItems_(chunkItems),
+    count_(0),
+    finished_(false)
+{
+    if (chunkItems == 0 || chunkItems > MAX_CHUNK_ITEMS){
+        throw std::invalid_argument("TreeStreamWriter: chunkItems out of range");
+    }
+    keys_.reserve(chunkItems);
+    values_.reserve(chunkItems);
+
+    TreeStreamHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TREE_STREAM_MAGIC, sizeof(header.magic));
+    header.version = TREE_STREAM_VERSION;
+    header.byteOrder = TREE_FILE_BYTE_ORDER;
+    header.flags = compress ? TREE_STREAM_COMPRESSED : 0;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    if (!out_.write(reinterpret_cast<const char*>(&header), sizeof(header))){
+        throw std::runtime_error("TreeStreamWriter: write failed");
+    }
+}
+
+template<class Key, class Value>
+void TreeStreamWriter<Key, Value>::write(const Key& key, const Value& value)
+{
+    if (finished_){
+        throw std::logic_error("TreeStreamWriter: write after finish");
+    }
+    keys_.push_back(key);
+    values_.push_back(value);
+    ++count_;
+    if (keys_.size() == chunkItems_){
+        flush();
+    }
+}
+
+template<class Key, class Value>
+void TreeStreamWriter<Key, Value>::write(const std::pair<const Key, Value>& item)
+{
+    write(item.first, item.second);
+}
+
+/**
+* Writes the buffered items, if any, as a chunk.
+*/
+template<class Key, class Value>
+void TreeStreamWriter<Key, Value>::flush()
+{
+    if (keys_.empty()){
+        return;
+    }
+    payload_.clear();
+    TreeStreamColumn<Key>::encode(keys_.data(), keys_.size(), compress_, true, payload_);
+    TreeStreamColumn<Value>::encode(values_.data(), values_.size(), compress_, false, payload_);
+    payload_.resize((payload_.size() + 7) / 8 * 8, 0);
+
+    TreeStreamChunk chunk;
+    chunk.count = keys_.size();
+    chunk.bytes = payload_.size();
+    chunk.checksum = treeFileChecksum(0, payload_.data(), payload_.size());
+    keys_.clear();
+    values_.clear();
+    if (!out_.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk))
+            || !out_.write(payload_.data(), payload_.size())){
+        throw std::runtime_error("TreeStreamWriter: write failed");
+    }
+}
+
+/**
+* Writes the last chunk and the end marker, and flushes the ostream.
+* Nothing can be written afterwards.
+*/
+template<class Key, class Value>
+void TreeStreamWriter<Key, Value>::finish()
+{
+    if (finished_){
+        return;
+    }
+    flush();
+    TreeStreamChunk end;
+    std::memset(&end, 0, sizeof(end));
+    finished_ = true;
+    if (!out_.write(reinterpret_cast<const char*>(&end), sizeof(end)) || !out_.flush()){
+        throw std::runtime_error("TreeStreamWriter: write failed");
+    }
+}
+
+/**
+* Items written so far, including those still buffered.
+*/
+template<class Key, class Value>
+size_t TreeStreamWriter<Key, Value>::count() const
+{
+    return count_;
+}
+
+/*
+-----------------------------------------------
+End implementations for the TreeStreamWriter class.
+-----------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the TreeStreamReader class.
+-----------------------------------------------
+*/
+
+/**
+* Reads and checks the stream header.
+*/
+template<class Key, class Value>
+TreeStreamReader<Key, Value>::TreeStreamReader(std::istream& in) :
+    in_(in),
+    compress_(false),
+    next_(0),
+    done_(false)
+{
+    TreeStreamHeader header;
+    readBytes(&header, sizeof(header));
+    if (std::memcmp(header.magic, TREE_STREAM_MAGIC, sizeof(header.magic)) != 0){
+        throw std::runtime_error("TreeStreamReader: not a tree stream");
+    }
+    if (header.version != TREE_STREAM_VERSION){
+        throw std::runtime_error("TreeStreamReader: unsupported version");
+    }
+    if (header.byteOrder != TREE_FILE_BYTE_ORDER){
+        throw std::runtime_error("TreeStreamReader: written with another byte order");
+    }
+    if (header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)){
+        throw std::runtime_error("TreeStreamReader: key or value size does not match");
+    }
+    compress_ = (header.flags & TREE_STREAM_COMPRESSED) != 0;
+}
+
+/**
+* Replaces the contents of batch with the next items of the stream, at
+* most maxItems of them, in stream order. Returns how many were read: 0
+* only once the stream has ended.
+*/
+template<class Key, class Value>
+size_t TreeStreamReader<Key, Value>::read(std::vector<std::pair<Key, Value> >& batch, size_t maxItems)
+{
+    batch.clear();
+    while (batch.size() < maxItems && !done_){
+        if (next_ == keys_.size()){
+            readChunk();
+            continue;
+        }
+        batch.push_back(std::make_pair(keys_[next_], values_[next_]));
+        ++next_;
+    }
+    return batch.size();
+}
+
+/**
+* True once the end marker has been read and every item returned.
+*/
+template<class Key, class Value>
+bool TreeStreamReader<Key, Value>::done() const
+{
+    return done_;
+}
+
+template<class Key, class Value>
+void TreeStreamReader<Key, Value>::readChunk()
+{
+    TreeStreamChunk chunk;
+    readBytes(&chunk, sizeof(chunk));
+    if (chunk.count == 0){
+        done_ = true;
+        return;
+    }
+    // An uncompressed chunk is the largest, give or take the padding, and
+    // a varint is never longer than 10 bytes; anything beyond that is a
+    // damaged header, rejected before it can cause a huge allocation.
+    size_t largest = chunk.count * (std::max<size_t>(sizeof(Key), 10) + std::max<size_t>(sizeof(Value), 10)) + 8;
+    if (chunk.count > TreeStreamWriter<Key, Value>::MAX_CHUNK_ITEMS || chunk.bytes > largest
+            || chunk.bytes % 8 != 0){
+        throw std::runtime_error("TreeStreamReader: damaged chunk header");
+    }
+    payload_.resize(chunk.bytes);
+    readBytes(payload_.data(), payload_.size());
+    if (treeFileChecksum(0, payload_.data(), payload_.size()) != chunk.checksum){
+        throw std::runtime_error("TreeStreamReader: checksum mismatch");
+    }
+
+    keys_.resize(chunk.count);
+    values_.resize(chunk.count);
+    const char* end = payload_.data() + payload_.size();
+    const char* in = TreeStreamColumn<Key>::decode(payload_.data(), end, keys_.data(), chunk.count, compress_, true);
+    if (in != NULL){
+        in = TreeStreamColumn<Value>::decode(in, end, values_.data(), chunk.count, compress_, false);
+    }
+    if (in == NULL){
+        throw std::runtime_error("TreeStreamReader: damaged chunk");
+    }
+    next_ = 0;
+}
+
+template<class Key, class Value>
+void TreeStreamReader<Key, Value>::readBytes(void* data, size_t size)
+{
+    if (!in_.read(static_cast<char*>(data), size)){
+        throw std::runtime_error("TreeStreamReader: stream ends early");
+    }
+}
+
+/*
+-----------------------------------------------
+End implementations for the TreeStreamReader class.
+-----------------------------------------------
+*/
+
+#endif